@@ -0,0 +1,302 @@
+#pragma once
+
+#include <mutex>
+
+#include "component.hpp"
+
+// Pool of heap blocks used by buffer components when they outgrow their
+// inline capacity. Blocks are grouped by power of two size classes and kept
+// in free lists when released, so resizing buffers rarely reach the allocator.
+class BufferPool
+{
+public:
+   ~BufferPool()
+   {
+      for (SizeClass& sizeClass : m_classes)
+      {
+         for (void* block : sizeClass.free)
+         {
+            ::operator delete(block);
+         }
+      }
+   }
+
+   static BufferPool& instance()
+   {
+      static BufferPool pool;
+      return pool;
+   }
+
+   // Size in byte of the block returned when asking for the given size
+   static size_t blockSize(size_t size)
+   {
+      size_t block = MIN_BLOCK_SIZE;
+      while (block < size)
+      {
+         block *= 2;
+      }
+
+      return block;
+   }
+
+   // Thread safe
+   void* allocate(size_t size)
+   {
+      size_t block = blockSize(size);
+      std::optional<size_t> index = classIndex(block);
+
+      if (index.has_value())
+      {
+         SizeClass& sizeClass = m_classes[index.value()];
+         std::lock_guard<std::mutex> lock(sizeClass.mutex);
+
+         if (!sizeClass.free.empty())
+         {
+            void* result = sizeClass.free.back();
+            sizeClass.free.pop_back();
+            return result;
+         }
+      }
+
+      return ::operator new(block);
+   }
+
+   // Thread safe, size must be the one given to allocate
+   void release(void* memory, size_t size)
+   {
+      std::optional<size_t> index = classIndex(blockSize(size));
+
+      if (index.has_value())
+      {
+         SizeClass& sizeClass = m_classes[index.value()];
+         std::lock_guard<std::mutex> lock(sizeClass.mutex);
+         sizeClass.free.push_back(memory);
+      }
+      else
+      {
+         ::operator delete(memory);
+      }
+   }
+
+private:
+   struct SizeClass
+   {
+      std::mutex mutex;
+      std::vector<void*> free;
+   };
+
+   static constexpr size_t MIN_BLOCK_SIZE = 64;
+
+   // Blocks bigger than MIN_BLOCK_SIZE << (CLASS_COUNT - 1) are not pooled
+   static constexpr size_t CLASS_COUNT = 11;
+
+   std::array<SizeClass, CLASS_COUNT> m_classes;
+
+   std::optional<size_t> classIndex(size_t block)
+   {
+      size_t index = 0;
+      while ((MIN_BLOCK_SIZE << index) < block)
+      {
+         index++;
+      }
+
+      if (index < CLASS_COUNT)
+      {
+         return index;
+      }
+
+      return std::nullopt;
+   }
+};
+
+// A variable length list component. The first N elements are stored inline,
+// in the chunk column, and only bigger buffers spill to a pooled heap block.
+// A zeroed buffer is a valid empty buffer, so new chunk lines need no
+// initialization. Heap storage is released when the chunk is destroyed, as
+// buffers in chunk columns are never destroyed as objects, or when a buffer
+// outside of a chunk is destroyed.
+template<typename T, size_t N>
+struct Buffer
+{
+   static_assert(std::is_trivially_copyable_v<T>, "Buffer elements are moved with memcpy");
+   static_assert(N > 0, "Buffer needs an inline capacity");
+
+   Buffer() = default;
+
+   ~Buffer()
+   {
+      release();
+   }
+
+   // A buffer owns its heap storage, copying it would share it. Moving it
+   // hands the storage over and leaves the other buffer empty.
+   Buffer(const Buffer&) = delete;
+   Buffer& operator=(const Buffer&) = delete;
+
+   Buffer(Buffer&& other)
+   {
+      take(other);
+   }
+
+   Buffer& operator=(Buffer&& other)
+   {
+      if (this != &other)
+      {
+         release();
+         take(other);
+      }
+
+      return *this;
+   }
+
+   inline size_t size() const
+   {
+      return m_size;
+   }
+
+   inline bool empty() const
+   {
+      return m_size == 0;
+   }
+
+   inline size_t capacity() const
+   {
+      return m_heap == nullptr ? N : m_capacity;
+   }
+
+   // Return if the elements are still stored in the chunk
+   inline bool isInline() const
+   {
+      return m_heap == nullptr;
+   }
+
+   inline T* data()
+   {
+      return m_heap == nullptr ? reinterpret_cast<T*>(m_inline) : m_heap;
+   }
+
+   inline const T* data() const
+   {
+      return m_heap == nullptr ? reinterpret_cast<const T*>(m_inline) : m_heap;
+   }
+
+   inline T* begin() { return data(); }
+   inline T* end() { return data() + m_size; }
+   inline const T* begin() const { return data(); }
+   inline const T* end() const { return data() + m_size; }
+
+   inline T& operator[](size_t index)
+   {
+      assert(index < m_size);
+      return data()[index];
+   }
+
+   inline const T& operator[](size_t index) const
+   {
+      assert(index < m_size);
+      return data()[index];
+   }
+
+   void push_back(const T& value)
+   {
+      if (m_size == capacity())
+      {
+         // The value may be an element of this buffer, released by reserve
+         alignas(T) unsigned char copy[sizeof(T)];
+         memcpy(copy, &value, sizeof(T));
+
+         reserve(capacity() * 2);
+         memcpy(data() + m_size, copy, sizeof(T));
+      }
+      else
+      {
+         memcpy(data() + m_size, &value, sizeof(T));
+      }
+
+      m_size++;
+   }
+
+   inline void pop_back()
+   {
+      assert(m_size > 0);
+      m_size--;
+   }
+
+   // Remove all elements, keeping the current storage
+   inline void clear()
+   {
+      m_size = 0;
+   }
+
+   void reserve(size_t newCapacity)
+   {
+      if (newCapacity <= capacity())
+      {
+         return;
+      }
+
+      size_t block = BufferPool::blockSize(newCapacity * sizeof(T));
+      T* heap = static_cast<T*>(BufferPool::instance().allocate(block));
+      memcpy(heap, data(), m_size * sizeof(T));
+
+      release();
+
+      m_heap = heap;
+      m_capacity = static_cast<uint32_t>(block / sizeof(T));
+   }
+
+   // Give the heap storage back to the pool, the buffer is then empty
+   void release()
+   {
+      if (m_heap != nullptr)
+      {
+         BufferPool::instance().release(m_heap, m_capacity * sizeof(T));
+         m_heap = nullptr;
+         m_capacity = 0;
+      }
+   }
+
+   // Release the buffers of a chunk column
+   static void releaseColumn(void* column, size_t count)
+   {
+      Buffer* buffers = static_cast<Buffer*>(column);
+      for (size_t i = 0; i < count; i++)
+      {
+         buffers[i].release();
+      }
+   }
+
+private:
+   void take(Buffer& other)
+   {
+      m_size = other.m_size;
+      m_capacity = other.m_capacity;
+      m_heap = other.m_heap;
+
+      if (m_heap == nullptr)
+      {
+         memcpy(m_inline, other.m_inline, m_size * sizeof(T));
+      }
+
+      other.m_size = 0;
+      other.m_capacity = 0;
+      other.m_heap = nullptr;
+   }
+
+   uint32_t m_size{0};
+
+   // Number of elements in m_heap, unused while inline
+   uint32_t m_capacity{0};
+
+   T* m_heap{nullptr};
+
+   alignas(T) unsigned char m_inline[N * sizeof(T)];
+};
+
+template<typename T, size_t N>
+struct component_traits<Buffer<T, N>>
+{
+   using type = Buffer<T, N>;
+   static constexpr ComponentKind kind = ComponentKind::Line;
+   static constexpr ComponentRelease release = &Buffer<T, N>::releaseColumn;
+};
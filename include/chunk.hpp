@@ -5,6 +5,70 @@
 // The size in byte of a chunk
 const size_t CHUNK_SIZE = 16384;
 
+// Version used to track when a component was last written
+using ChangeVersion = uint32_t;
+
+// Word used by the per chunk bitmasks, one bit per entity line
+using MaskWord = uint64_t;
+
+const size_t MASK_WORD_BITS = 64;
+
+// Number of mask words needed to hold one bit per line
+inline size_t maskWordCount(size_t lines)
+{
+   return (lines + MASK_WORD_BITS - 1) / MASK_WORD_BITS;
+}
+
+// Reference to the value of a packed component on one line of a chunk.
+// When given the change version of the component in the chunk, assigning a
+// value marks the component as changed at the given version.
+template<typename C>
+class PackedRef
+{
+public:
+   static constexpr size_t BITS = packed_component<C>::bits;
+
+   static constexpr MaskWord MASK = (MaskWord(1) << BITS) - 1;
+
+   PackedRef(MaskWord& word, size_t shift, ChangeVersion* changeVersion = nullptr, ChangeVersion version = 0)
+      : m_word(word), m_shift(shift), m_changeVersion(changeVersion), m_version(version)
+   {
+   }
+
+   operator C() const
+   {
+      uint8_t raw = static_cast<uint8_t>((m_word >> m_shift) & MASK);
+      C value;
+      memcpy(&value, &raw, sizeof(C));
+      return value;
+   }
+
+   PackedRef& operator=(const C& value)
+   {
+      uint8_t raw;
+      memcpy(&raw, &value, sizeof(C));
+      m_word = (m_word & ~(MASK << m_shift)) | ((MaskWord(raw) & MASK) << m_shift);
+
+      if (m_changeVersion != nullptr)
+      {
+         *m_changeVersion = m_version;
+      }
+
+      return *this;
+   }
+
+   PackedRef& operator=(const PackedRef& other)
+   {
+      return *this = static_cast<C>(other);
+   }
+
+private:
+   MaskWord& m_word;
+   size_t m_shift;
+   ChangeVersion* m_changeVersion;
+   ChangeVersion m_version;
+};
+
 struct ChunkLayout
 {
    // The component archetype of this chunk kind
@@ -13,41 +77,133 @@ struct ChunkLayout
    // Map a component to the start in the actual chunk
    std::array<size_t, MAX_COMPONENTS> componentStart{};
 
+   // Size in byte of the chunk components, stored at the start of the chunk
+   size_t chunkDataSize{0};
+
+   // Map an enableable component to the start of its enabled bitmask
+   std::array<size_t, MAX_COMPONENTS> enabledStart{};
+
+   // Number of enableable components, each one has a bitmask
+   size_t enabledMaskCount{0};
+
    // Number of entities that can go in a chunk
    size_t capacity{0};
 
    ChunkLayout() = default;
 };
 
+// Size in byte of the columns of bits (enabled bitmasks and packed
+// components) needed by the given archetype for the given capacity
+static size_t bitColumnsSize(Archetype archetype, size_t capacity) noexcept
+{
+   size_t size = 0;
+
+   for (size_t type = 0; type < archetype.size(); type++)
+   {
+      if (archetype[type])
+      {
+         ComponentType component = static_cast<ComponentType>(type);
+
+         if (isEnableable(component))
+         {
+            size += maskWordCount(capacity) * sizeof(MaskWord);
+         }
+
+         if (packedBits(component) > 0)
+         {
+            size += maskWordCount(capacity * packedBits(component)) * sizeof(MaskWord);
+         }
+      }
+   }
+
+   return size;
+}
+
 static ChunkLayout computeChunkLayout(Archetype archetype) noexcept
 {
    ChunkLayout layout;
    layout.archetype = archetype;
 
-   // First compute the size of an entity line in the chunk
+   // First compute the size of an entity line in the chunk, and place the
+   // chunk components at the start of the chunk
    size_t entitySize = 0;
 
+   // Bits taken by an entity line in the bitmasks and packed columns
+   size_t lineBits = 0;
+
    for (size_t type = 0; type < archetype.size(); type++)
    {
       if (archetype[type])
       {
-          entitySize += componentSize(static_cast<ComponentType>(type));
+         ComponentType component = static_cast<ComponentType>(type);
+
+         if (componentKind(component) == ComponentKind::Chunk)
+         {
+            layout.componentStart[type] = layout.chunkDataSize;
+            layout.chunkDataSize += componentSize(component);
+         }
+         else if (packedBits(component) > 0)
+         {
+            lineBits += packedBits(component);
+         }
+         else
+         {
+            entitySize += componentSize(component);
+         }
+
+         if (isEnableable(component))
+         {
+            layout.enabledMaskCount++;
+            lineBits++;
+         }
       }
    }
 
-   // Then compute how many entities can fit in this chunk
-   layout.capacity = CHUNK_SIZE / entitySize;
+   assert(entitySize > 0 || lineBits > 0);
+
+   // Bitmasks are read word by word, keep them aligned
+   size_t masksStart = (layout.chunkDataSize + sizeof(MaskWord) - 1) / sizeof(MaskWord) * sizeof(MaskWord);
+   assert(masksStart < CHUNK_SIZE);
+
+   // Then compute how many entities can fit in the rest of this chunk,
+   // accounting for the rounding of bit columns to whole words
+   size_t available = CHUNK_SIZE - masksStart;
+   layout.capacity = available * 8 / (entitySize * 8 + lineBits);
+
+   while (layout.capacity * entitySize + bitColumnsSize(archetype, layout.capacity) > available)
+   {
+      layout.capacity--;
+   }
 
    assert(layout.capacity > 0);
 
-   size_t currentStart = 0;
+   size_t currentStart = masksStart;
 
    for (size_t type = 0; type < archetype.size(); type++)
    {
-      if (archetype[type])
+      ComponentType component = static_cast<ComponentType>(type);
+
+      if (archetype[type] && isEnableable(component))
+      {
+         layout.enabledStart[type] = currentStart;
+         currentStart += maskWordCount(layout.capacity) * sizeof(MaskWord);
+      }
+
+      if (archetype[type] && packedBits(component) > 0)
       {
          layout.componentStart[type] = currentStart;
-         currentStart += layout.capacity * componentSize(static_cast<ComponentType>(type));
+         currentStart += maskWordCount(layout.capacity * packedBits(component)) * sizeof(MaskWord);
+      }
+   }
+
+   for (size_t type = 0; type < archetype.size(); type++)
+   {
+      ComponentType component = static_cast<ComponentType>(type);
+
+      if (archetype[type] && componentKind(component) == ComponentKind::Line && packedBits(component) == 0)
+      {
+         layout.componentStart[type] = currentStart;
+         currentStart += layout.capacity * componentSize(component);
       }
    }
 
@@ -59,6 +215,8 @@ template<size_t I = 0, typename... Ts>
 void set(const ChunkLayout& layout, std::vector<uint8_t>& memory, std::tuple<Ts*...>& t)
 {
    using Component = std::tuple_element_t<I, std::tuple<Ts...>>;
+   static_assert(packed_component<std::decay_t<Component>>::bits == 0,
+         "Packed components are accessed with getPacked or eachPacked");
 
    ComponentType type = componentType<std::decay_t<Component>>();
    size_t start = layout.componentStart[type];
@@ -87,12 +245,46 @@ struct Chunk
 {
    const ChunkLayout& layout;
 
+   // The memory is zeroed by the creating thread: with the first touch policy
+   // of the kernel, it lands on the NUMA node of that thread
    explicit Chunk(const ChunkLayout& chunkLayout) : layout(chunkLayout), m_count(0), m_memory(CHUNK_SIZE)
    {
+      // Lines start with all their enableable components enabled
+      for (size_t type = 0; type < layout.archetype.size(); type++)
+      {
+         if (layout.archetype[type] && isEnableable(static_cast<ComponentType>(type)))
+         {
+            memset(&m_memory[layout.enabledStart[type]], 0xFF, maskWordCount(layout.capacity) * sizeof(MaskWord));
+         }
+      }
    }
 
+   // Chunks may own resources through their components (see Buffer), so
+   // they can only be moved
+   Chunk(const Chunk&) = delete;
    Chunk& operator=(const Chunk&) = delete;
 
+   Chunk(Chunk&& other) noexcept
+      : layout(other.layout), m_count(other.m_count), m_memory(std::move(other.m_memory)),
+        m_changeVersions(other.m_changeVersions)
+   {
+      other.m_count = 0;
+   }
+
+   ~Chunk()
+   {
+      for (size_t type = 0; type < layout.archetype.size() && m_count > 0; type++)
+      {
+         ComponentType component = static_cast<ComponentType>(type);
+
+         if (layout.archetype[type] && componentKind(component) == ComponentKind::Line
+               && componentRelease(component) != nullptr)
+         {
+            componentRelease(component)(&m_memory[layout.componentStart[type]], m_count);
+         }
+      }
+   }
+
    inline size_t computeIndex(ComponentType type, size_t index, size_t size)
    {
       assert(layout.archetype[type]);
@@ -104,6 +296,7 @@ struct Chunk
    template<typename C>
    inline C& getComponent(size_t index)
    {
+      static_assert(packed_component<C>::bits == 0, "Use getPacked for packed components");
       assert(layout.archetype[componentType<C>()]);
       assert(index < m_count);
 
@@ -117,8 +310,16 @@ struct Chunk
    template<typename C>
    inline void setComponent(size_t index, const C& component)
    {
+      static_assert(component_traits<C>::release == nullptr,
+                    "Components owning storage, such as buffers, are moved in");
       assert(layout.archetype[componentType<C>()]);
 
+      if constexpr (packed_component<C>::bits > 0)
+      {
+         getPacked<C>(index) = component;
+         return;
+      }
+
       size_t memoryIndex = computeIndex(componentType<C>(), index, sizeof(C));
 
       assert(memoryIndex < CHUNK_SIZE);
@@ -126,11 +327,210 @@ struct Chunk
       memcpy(&m_memory[memoryIndex], &component, sizeof(C));
    }
 
-   // Call the given functor with the components specified by the functor's parameter types.
+   // Move the component into the line. The storage of a component owning
+   // some, such as a buffer, is handed over and the previous one released.
+   template<typename C, typename = std::enable_if_t<!std::is_reference_v<C>>>
+   inline void setComponent(size_t index, C&& component)
+   {
+      if constexpr (component_traits<C>::release == nullptr)
+      {
+         setComponent<C>(index, static_cast<const C&>(component));
+      }
+      else
+      {
+         getComponent<C>(index) = std::move(component);
+      }
+   }
+
+   // Copy the memory of the chunk to new pages, zeroed first by the calling
+   // thread: with the first touch policy of the kernel, they land on the
+   // NUMA node of that thread. Call it from a job of the worker processing
+   // the chunk, such as a parallel_for with a JobAffinity, when chunks were
+   // created on another node. References into the chunk are invalidated.
+   void relocate()
+   {
+      std::vector<uint8_t> memory(CHUNK_SIZE);
+      memcpy(memory.data(), m_memory.data(), CHUNK_SIZE);
+      m_memory.swap(memory);
+   }
+
+   // Start of the values of the line component C, for all the capacity of
+   // the chunk, to fill many lines at once, for instance reading them from a
+   // file (see JobIO)
+   template<typename C>
+   inline C* column()
+   {
+      static_assert(packed_component<C>::bits == 0, "Use packedWords for packed components");
+      assert(layout.archetype[componentType<C>()]);
+
+      return reinterpret_cast<C*>(&m_memory[layout.componentStart[componentType<C>()]]);
+   }
+
+   // Get a proxy to the packed component C of the given line. Writes through
+   // it are not marked as changed, see getPacked(index, version).
+   template<typename C>
+   inline PackedRef<C> getPacked(size_t index)
+   {
+      assert(index < layout.capacity);
+
+      size_t bit = index * packed_component<C>::bits;
+      return PackedRef<C>(packedWords<C>()[bit / MASK_WORD_BITS], bit % MASK_WORD_BITS);
+   }
+
+   // Get a proxy to the packed component C of the given line, marking it as
+   // changed at the given version when written
+   template<typename C>
+   inline PackedRef<C> getPacked(size_t index, ChangeVersion version)
+   {
+      assert(index < layout.capacity);
+
+      size_t bit = index * packed_component<C>::bits;
+      return PackedRef<C>(packedWords<C>()[bit / MASK_WORD_BITS], bit % MASK_WORD_BITS,
+            &m_changeVersions[componentType<C>()], version);
+   }
+
+   // Words holding the packed component C, each one holds the values of
+   // MASK_WORD_BITS / bits consecutive lines, the first line in the low bits
+   template<typename C>
+   inline MaskWord* packedWords()
+   {
+      ComponentType type = componentType<C>();
+      assert(layout.archetype[type] && packedBits(type) > 0);
+
+      return reinterpret_cast<MaskWord*>(&m_memory[layout.componentStart[type]]);
+   }
+
+   // Number of packed words of C covering the lines of this chunk
+   template<typename C>
+   inline size_t packedWordCount()
+   {
+      return maskWordCount(m_count * packed_component<C>::bits);
+   }
+
+   // Call the given functor with each word of the packed component C, so
+   // bitwise operations apply to many lines at once: [](MaskWord& word) {}
+   // C is marked as changed at the given version.
+   template<typename C, typename F>
+   inline void eachPacked(F&& func, ChangeVersion version)
+   {
+      markChanged<C>(version);
+
+      MaskWord* words = packedWords<C>();
+      size_t bits = m_count * packed_component<C>::bits;
+      size_t fullWords = bits / MASK_WORD_BITS;
+
+      for (size_t i = 0; i < fullWords; i++)
+      {
+         func(words[i]);
+      }
+
+      // Bits past the last line are kept, they belong to lines not created yet
+      if (bits % MASK_WORD_BITS != 0)
+      {
+         MaskWord lines = (MaskWord(1) << (bits % MASK_WORD_BITS)) - 1;
+         MaskWord word = words[fullWords];
+         func(word);
+         words[fullWords] = (word & lines) | (words[fullWords] & ~lines);
+      }
+   }
+
+   // Enable or disable the enableable component C on the given line
+   template<typename C>
+   inline void setEnabled(size_t index, bool enabled)
+   {
+      assert(index < layout.capacity);
+
+      MaskWord& word = enabledMask<C>()[index / MASK_WORD_BITS];
+      MaskWord bit = MaskWord(1) << (index % MASK_WORD_BITS);
+
+      word = enabled ? (word | bit) : (word & ~bit);
+   }
+
+   template<typename C>
+   inline bool isEnabled(size_t index)
+   {
+      assert(index < layout.capacity);
+      return (enabledMask<C>()[index / MASK_WORD_BITS] >> (index % MASK_WORD_BITS)) & 1;
+   }
+
+   // Bitmask of the lines having the enableable component C enabled
+   template<typename C>
+   inline MaskWord* enabledMask()
+   {
+      ComponentType type = componentType<C>();
+      assert(layout.archetype[type] && isEnableable(type));
+
+      return reinterpret_cast<MaskWord*>(&m_memory[layout.enabledStart[type]]);
+   }
+
+   // Get the chunk component C of this chunk
+   template<typename C>
+   inline const C& getChunkComponent() const
+   {
+      ComponentType type = componentType<ChunkComponent<C>>();
+      assert(layout.archetype[type]);
+
+      return reinterpret_cast<const C&>(m_memory[layout.componentStart[type]]);
+   }
+
+   // Get the chunk component C of this chunk to modify it, marking it as
+   // changed at the given version
+   template<typename C>
+   inline C& getChunkComponent(ChangeVersion version)
+   {
+      markChanged<ChunkComponent<C>>(version);
+      return const_cast<C&>(static_cast<const Chunk&>(*this).getChunkComponent<C>());
+   }
+
+   template<typename C>
+   inline void setChunkComponent(const C& component, ChangeVersion version)
+   {
+      memcpy(&getChunkComponent<C>(version), &component, sizeof(C));
+   }
+
+   // Record that the component C (a line or a chunk component) has been
+   // written at the given version
+   template<typename C>
+   inline void markChanged(ChangeVersion version)
+   {
+      assert(layout.archetype[componentType<C>()]);
+      m_changeVersions[componentType<C>()] = version;
+   }
+
+   // Version at which the component C was last written in this chunk
+   template<typename C>
+   inline ChangeVersion changeVersion() const
+   {
+      return m_changeVersions[componentType<C>()];
+   }
+
+   // Return if the component C was written after the given version
+   template<typename C>
+   inline bool didChange(ChangeVersion version) const
+   {
+      // Difference is used to stay correct when versions wrap around
+      return static_cast<int32_t>(changeVersion<C>() - version) > 0;
+   }
+
+   // Call the given functor with the components specified by the functor's
+   // parameter types. Components taken by non const reference are marked as
+   // changed at the given version.
+   template<typename F>
+   inline void each(F&& func, ChangeVersion version)
+   {
+      markWritten(version, static_cast<const typename functor_traits<std::decay_t<F>>::args_t*>(nullptr));
+      each_helper(std::forward<F>(func), typename functor_traits<std::decay_t<F>>::args_pointer_t{});
+   }
+
+   // Same for functors only reading the components, the others must give the
+   // version to mark them as changed
    template<typename F>
    inline void each(F&& func)
    {
-      each_helper(std::forward<F>(func), typename functor_traits<F>::args_pointer_t{});
+      static_assert(!writesAny(static_cast<const typename functor_traits<std::decay_t<F>>::args_t*>(nullptr)),
+            "Functors writing components must give the version, see each(func, version)");
+
+      each_helper(std::forward<F>(func), typename functor_traits<std::decay_t<F>>::args_pointer_t{});
    }
 
    inline size_t count()
@@ -147,15 +547,104 @@ private:
    // The fixed memory content of this chunk
    std::vector<uint8_t> m_memory;
 
+   // Last version at which each component was written
+   std::array<ChangeVersion, MAX_COMPONENTS> m_changeVersions{};
+
+   // Mark the components taken by non const reference in Args as changed
+   template<typename... Args>
+   inline void markWritten(ChangeVersion version, const std::tuple<Args...>*)
+   {
+      (markWritten<Args>(version), ...);
+   }
+
+   template<typename Arg>
+   inline void markWritten(ChangeVersion version)
+   {
+      if constexpr (writes<Arg>())
+      {
+         markChanged<std::decay_t<Arg>>(version);
+      }
+   }
+
+   // Return if a functor parameter of type Arg can write the component,
+   // being a non const reference
+   template<typename Arg>
+   static constexpr bool writes()
+   {
+      return std::is_lvalue_reference_v<Arg> && !std::is_const_v<std::remove_reference_t<Arg>>;
+   }
+
+   template<typename... Args>
+   static constexpr bool writesAny(const std::tuple<Args...>*)
+   {
+      return (writes<Args>() || ...);
+   }
+
+   // Get the chunk component for a functor parameter of type Arg, only
+   // marking it as changed when taken by non const reference
+   template<typename Arg>
+   inline Arg chunkComponentArg(ChangeVersion version)
+   {
+      if constexpr (std::is_const_v<std::remove_reference_t<Arg>>)
+      {
+         return getChunkComponent<std::decay_t<Arg>>();
+      }
+      else
+      {
+         return getChunkComponent<std::decay_t<Arg>>(version);
+      }
+   }
+
    template<typename F, typename... Cs>
-   inline void each_helper(F&& func, std::tuple<Cs...> pointers)
+   inline void each_helper(F&& func, std::tuple<Cs*...> pointers)
    {
       set(layout, m_memory, pointers);
 
-      for (size_t i = 0; i < m_count; i++)
+      if constexpr ((enableable_component<Cs>::value || ...))
+      {
+         // Scan the enabled bits a word at a time, only visiting lines having
+         // all the enableable components enabled
+         for (size_t word = 0; word * MASK_WORD_BITS < m_count; word++)
+         {
+            MaskWord bits = ~MaskWord(0);
+            ((bits &= enabledWord<Cs>(word)), ...);
+
+            size_t remaining = m_count - word * MASK_WORD_BITS;
+            if (remaining < MASK_WORD_BITS)
+            {
+               bits &= (MaskWord(1) << remaining) - 1;
+            }
+
+            while (bits != 0)
+            {
+               size_t i = word * MASK_WORD_BITS + __builtin_ctzll(bits);
+               bits &= bits - 1;
+
+               std::apply([&func, i](auto*... args) {func(args[i]...);}, pointers);
+            }
+         }
+      }
+      else
+      {
+         for (size_t i = 0; i < m_count; i++)
+         {
+            std::apply(func, deref(pointers));
+            std::apply([](auto&&... args) {((args++), ...);}, pointers);
+         }
+      }
+   }
+
+   // Enabled bits of the given word for C, all set if C is not enableable
+   template<typename C>
+   inline MaskWord enabledWord(size_t word)
+   {
+      if constexpr (enableable_component<C>::value)
+      {
+         return enabledMask<C>()[word];
+      }
+      else
       {
-         std::apply(func, deref(pointers));
-         std::apply([](auto&&... args) {((args++), ...);}, pointers);
+         return ~MaskWord(0);
       }
    }
 };
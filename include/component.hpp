@@ -9,8 +9,69 @@ const ComponentType MAX_COMPONENTS = 32;
 // Type for a computeArchetype of components
 using Archetype = std::bitset<MAX_COMPONENTS>;
 
+// Where a component is stored in a chunk
+enum class ComponentKind : uint8_t
+{
+   // One value per entity line, stored in a column
+   Line,
+   // One value for the whole chunk
+   Chunk
+};
+
+// Wrap a component type to attach it to a chunk instead of each entity line.
+// Use ChunkComponent<C> in archetypes, and C to access the value on a chunk.
+template<typename C>
+struct ChunkComponent
+{
+   using type = C;
+};
+
+// Release the resources owned by count components stored contiguously
+using ComponentRelease = void (*)(void* components, size_t count);
+
+// Describe how a component type is stored
+template<typename C>
+struct component_traits
+{
+   using type = C;
+   static constexpr ComponentKind kind = ComponentKind::Line;
+   // Called on the lines of a chunk when it is destroyed, if any
+   static constexpr ComponentRelease release = nullptr;
+};
+
+template<typename C>
+struct component_traits<ChunkComponent<C>>
+{
+   using type = C;
+   static constexpr ComponentKind kind = ComponentKind::Chunk;
+   static constexpr ComponentRelease release = nullptr;
+};
+
+// Specialize to std::true_type to make a line component enableable. Each
+// chunk then keeps a bitmask telling which lines have it enabled, and
+// Chunk::each skips the disabled ones. Toggling it does not move the entity.
+template<typename C>
+struct enableable_component : std::false_type {};
+
+// Specialize with a bits member (1, 2, 4 or 8) to store a one byte component,
+// like a flag or a small enum, bit-packed in its chunk column. Its lines are
+// then accessed through PackedRef proxies, or a word at a time.
+template<typename C>
+struct packed_component
+{
+   static constexpr size_t bits = 0;
+};
+
 static std::array<size_t, MAX_COMPONENTS> componentSizes;
 
+static std::array<ComponentKind, MAX_COMPONENTS> componentKinds;
+
+static std::array<bool, MAX_COMPONENTS> componentEnableable;
+
+static std::array<ComponentRelease, MAX_COMPONENTS> componentReleases;
+
+static std::array<size_t, MAX_COMPONENTS> componentPackedBits;
+
 inline ComponentType nextId()
 {
    static ComponentType next = 0;
@@ -22,11 +83,40 @@ inline size_t componentSize(ComponentType type)
    return componentSizes[type];
 }
 
+inline ComponentKind componentKind(ComponentType type)
+{
+   return componentKinds[type];
+}
+
+inline bool isEnableable(ComponentType type)
+{
+   return componentEnableable[type];
+}
+
+inline ComponentRelease componentRelease(ComponentType type)
+{
+   return componentReleases[type];
+}
+
+// Number of bits used per line by a packed component, 0 if not packed
+inline size_t packedBits(ComponentType type)
+{
+   return componentPackedBits[type];
+}
+
 template<typename C>
 ComponentType componentType()
 {
+   static_assert(packed_component<C>::bits == 0 ||
+         (sizeof(C) == 1 && std::is_trivially_copyable_v<C> && 8 % packed_component<C>::bits == 0),
+         "Packed components are one byte, stored on 1, 2, 4 or 8 bits");
+
    static const ComponentType id = nextId();
-   componentSizes[id] = sizeof(C);
+   componentSizes[id] = sizeof(typename component_traits<C>::type);
+   componentKinds[id] = component_traits<C>::kind;
+   componentEnableable[id] = enableable_component<C>::value;
+   componentReleases[id] = component_traits<C>::release;
+   componentPackedBits[id] = packed_component<C>::bits;
    return id;
 }
 
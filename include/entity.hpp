@@ -16,6 +16,7 @@
 #include "functor_traits.hpp"
 #include "component.hpp"
 #include "chunk.hpp"
+#include "buffer.hpp"
 
 // A simple type alias
 using Entity = uint64_t;
@@ -24,11 +25,15 @@ using Entity = uint64_t;
 struct ChunkFamily
 {
    const Archetype archetype;
+
+   // Layout shared by all chunks of this family, it must outlive them
+   std::unique_ptr<ChunkLayout> layout;
+
    // TODO: maybe a list would be better here
    std::vector<Chunk> chunks;
 
    ChunkFamily(Archetype newArchetype):
-      archetype(newArchetype)
+      archetype(newArchetype), layout(new ChunkLayout(computeChunkLayout(newArchetype)))
    {
    }
 };
@@ -50,7 +55,7 @@ struct EntityLocation
 struct EntityManager
 {
 public:
-   EntityManager() : currentEntity(0) {}
+   EntityManager() : currentEntity(0), globalVersion(1) {}
 
    // Create an uninitialized entity, setComponent can be called to initialize
    // it
@@ -78,16 +83,119 @@ public:
    {
       EntityLocation loc = getLocation(e);
       get(loc).setComponent(loc.chunkLine, component);
+      get(loc).markChanged<C>(globalVersion);
+   }
+
+   // Move the given component into the given entity, see
+   // Chunk::setComponent
+   template<typename C, typename = std::enable_if_t<!std::is_reference_v<C>>>
+   inline void setComponent(Entity e, C&& component)
+   {
+      EntityLocation loc = getLocation(e);
+      get(loc).setComponent(loc.chunkLine, std::move(component));
+      get(loc).markChanged<C>(globalVersion);
    }
 
-   // Get the given comoponent of the given entity
+   // Get the given comoponent of the given entity. It may be written through
+   // the reference, so it is marked as changed.
    template<typename C>
    inline C& getComponent(Entity e)
    {
       EntityLocation loc = getLocation(e);
+      get(loc).markChanged<C>(globalVersion);
       return get(loc).getComponent<C>(loc.chunkLine);
    }
 
+   // Get a proxy to the given packed component of the given entity, marking
+   // it as changed when written
+   template<typename C>
+   inline PackedRef<C> getPacked(Entity e)
+   {
+      EntityLocation loc = getLocation(e);
+      return get(loc).getPacked<C>(loc.chunkLine, globalVersion);
+   }
+
+   // Enable or disable the given enableable component of the given entity.
+   // This only flips a bit, the entity stays in its chunk.
+   template<typename C>
+   inline void setEnabled(Entity e, bool enabled)
+   {
+      EntityLocation loc = getLocation(e);
+      get(loc).setEnabled<C>(loc.chunkLine, enabled);
+      get(loc).markChanged<C>(globalVersion);
+   }
+
+   template<typename C>
+   inline bool isEnabled(Entity e)
+   {
+      EntityLocation loc = getLocation(e);
+      return get(loc).isEnabled<C>(loc.chunkLine);
+   }
+
+   // Set the given chunk component of the chunk containing the given entity
+   template<typename C>
+   inline void setChunkComponent(Entity e, const C& component)
+   {
+      get(getLocation(e)).setChunkComponent(component, globalVersion);
+   }
+
+   // Get the given chunk component of the chunk containing the given entity
+   template<typename C>
+   inline const C& getChunkComponent(Entity e)
+   {
+      return get(getLocation(e)).getChunkComponent<C>();
+   }
+
+   // Set the singleton component C, creating it if needed
+   template<typename C>
+   inline void setSingleton(const C& component)
+   {
+      ComponentType type = componentType<C>();
+
+      if (singletons[type] == nullptr)
+      {
+         singletons[type] = std::make_shared<C>(component);
+      }
+      else
+      {
+         *static_cast<C*>(singletons[type].get()) = component;
+      }
+
+      singletonVersions[type] = globalVersion;
+   }
+
+   // Get the singleton component C to read it
+   template<typename C>
+   inline const C& getSingleton() const
+   {
+      assert(hasSingleton<C>());
+      return *static_cast<const C*>(singletons[componentType<C>()].get());
+   }
+
+   // Get the singleton component C to modify it, marking it as changed
+   template<typename C>
+   inline C& writeSingleton()
+   {
+      assert(hasSingleton<C>());
+      ComponentType type = componentType<C>();
+
+      singletonVersions[type] = globalVersion;
+      return *static_cast<C*>(singletons[type].get());
+   }
+
+   template<typename C>
+   inline bool hasSingleton() const
+   {
+      return singletons[componentType<C>()] != nullptr;
+   }
+
+   // Return if the singleton component C was written after the given version
+   template<typename C>
+   inline bool didSingletonChange(ChangeVersion version) const
+   {
+      return static_cast<int32_t>(singletonVersions[componentType<C>()] - version) > 0;
+   }
+
    // Call the given function with all the chunks that contains the given
    // components
    template<typename... Cs>
@@ -104,6 +212,31 @@ public:
       each_entity_helper(std::forward<F>(func), typename functor_traits<F>::args_pointer_t{});
    }
 
+   // Call the given functor with each chunk containing the chunk components
+   // specified by the functor's parameter types. The first parameter of the
+   // functor is the Chunk itself: [](Chunk& chunk, Bounds& bounds) {}
+   // Chunk components taken by non const reference are marked as changed.
+   // A functor taking only the chunk is called with every chunk.
+   template<typename F>
+   inline void each_chunk(F&& func)
+   {
+      each_chunk_helper(std::forward<F>(func), static_cast<typename functor_traits<F>::args_t*>(nullptr));
+   }
+
+   // Current version, used to mark components as changed when written
+   inline ChangeVersion getGlobalVersion() const
+   {
+      return globalVersion;
+   }
+
+   // Start a new version, typically before running a system. Components
+   // written from now on will be seen as changed by chunk.didChange(version)
+   // for any version obtained before.
+   inline ChangeVersion incrementGlobalVersion()
+   {
+      return ++globalVersion;
+   }
+
    // Get the location of an entity in the chunk data structure
    inline EntityLocation getLocation(Entity e) const
    {
@@ -127,6 +260,9 @@ public:
 private:
    size_t currentEntity;
 
+   // Version stamped on components when they are written
+   ChangeVersion globalVersion;
+
    // The chunk data structure.
    // Each chunk family have a list of chunks that all have the same archetype
    std::vector<ChunkFamily> chunkFamilies;
@@ -134,8 +270,11 @@ private:
    // Keep track of where an entity is in the chunkFamilies
    std::vector<std::optional<EntityLocation>> entityToLocation;
 
-   // Keep ownership of al chunk kinds created
-   std::vector<std::unique_ptr<ChunkLayout>> layouts;
+   // Components existing once, outside of any chunk, indexed by their type
+   std::array<std::shared_ptr<void>, MAX_COMPONENTS> singletons;
+
+   // Last version at which each singleton was written
+   std::array<ChangeVersion, MAX_COMPONENTS> singletonVersions{};
 
    std::optional<size_t> chunkFamilyIndex(Archetype archetype)
    {
@@ -181,12 +320,9 @@ private:
          familyIndex = chunkFamilies.size();
          chunkFamilies.emplace_back(archetype);
 
-         size_t layoutIndex = layouts.size();
-         layouts.emplace_back(new ChunkLayout(computeChunkLayout(archetype)));
-         const ChunkLayout& layout = *layouts[layoutIndex];
-
          // First chunk
-         chunkFamilies[familyIndex.value()].chunks.emplace_back(layout);
+         ChunkFamily& family = chunkFamilies[familyIndex.value()];
+         family.chunks.emplace_back(*family.layout);
          return { familyIndex.value(), 0, 0 };
       }
    }
@@ -254,8 +390,31 @@ private:
    template<typename F, typename... Cs>
    inline void each_entity_helper(F&& exec, const std::tuple<Cs*...>& pointers)
    {
-      each<std::decay_t<Cs>...>([&exec, &pointers](Chunk& chunk) {
+      ChangeVersion version = globalVersion;
+      const typename functor_traits<F>::args_t* args = nullptr;
+
+      each<std::decay_t<Cs>...>([&exec, &pointers, version, args](Chunk& chunk) {
+         chunk.markWritten(version, args);
          chunk.each_helper(std::forward<F>(exec), pointers);
       });
    }
+
+   // A functor taking only the chunk visits all of them
+   template<typename F>
+   inline void each_chunk_helper(F&& exec, const std::tuple<Chunk&>*)
+   {
+      each(Archetype(), [&exec](Chunk& chunk) {
+         exec(chunk);
+      });
+   }
+
+   template<typename F, typename Arg, typename... Args>
+   inline void each_chunk_helper(F&& exec, const std::tuple<Chunk&, Arg, Args...>*)
+   {
+      ChangeVersion version = globalVersion;
+
+      each<ChunkComponent<std::decay_t<Arg>>, ChunkComponent<std::decay_t<Args>>...>([&exec, version](Chunk& chunk) {
+         exec(chunk, chunk.chunkComponentArg<Arg>(version), chunk.chunkComponentArg<Args>(version)...);
+      });
+   }
 };
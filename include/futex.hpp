@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#endif
+
+// Minimal futex style parking on a 32 bit atomic. On Linux this is the
+// futex syscall, elsewhere a short sleep so callers re-check their condition.
+
+// Sleep while word still holds expected, until woken or the timeout expires.
+// Spurious wake ups are possible, the caller re-checks its condition.
+inline void futexWait(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::microseconds timeout)
+{
+   static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Futex needs a plain 32 bit word");
+
+#ifdef __linux__
+   struct timespec time;
+   time.tv_sec = static_cast<time_t>(timeout.count() / 1000000);
+   time.tv_nsec = static_cast<long>(timeout.count() % 1000000) * 1000;
+
+   syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &time, nullptr, 0);
+#else
+   if (word.load(std::memory_order_acquire) == expected)
+   {
+      std::this_thread::sleep_for(std::min(timeout, std::chrono::microseconds(50)));
+   }
+#endif
+}
+
+// Wake up to count threads sleeping on word
+inline void futexWake(std::atomic<uint32_t>& word, int count = INT_MAX)
+{
+#ifdef __linux__
+   syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#else
+   (void) word;
+   (void) count;
+#endif
+}
+
+// Hint the CPU that this thread is spinning
+inline void cpuPause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_ia32_pause();
+#elif defined(__aarch64__)
+   asm volatile("yield");
+#endif
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+// Coroutine jobs, C++20 only
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include "jobsystem.hpp"
+
+// A job written as a coroutine. Instead of calling JobSystem::wait, which
+// runs other jobs on the stack of the waiting one, it co_awaits job handles:
+// the coroutine is suspended, and a job resuming it is scheduled as a
+// continuation of the awaited job, on any worker. No thread is blocked.
+//
+// The first parameter of the coroutine is the job system running it:
+//
+//    JobCoroutine update(JobSystem& jobSystem, ...)
+//    {
+//       JobHandle load = jobSystem.create(...);
+//       jobSystem.schedule(load);
+//       co_await load;
+//       ...
+//    }
+//
+// Calling it schedules its first step, and handle() is then finished once
+// the coroutine returned, so it can be waited on or be a dependency.
+// Cancelling handle() destroys the coroutine at its next step.
+class JobCoroutine
+{
+public:
+   struct promise_type
+   {
+      JobSystem& system;
+
+      // Parent of all the steps of the coroutine
+      JobHandle completion;
+
+      template<typename... Args>
+      promise_type(JobSystem& jobSystem, Args&&...)
+         : system(jobSystem), completion(jobSystem.create([] {}))
+      {
+      }
+
+      // Member coroutines get the object first
+      template<typename T, typename... Args>
+      promise_type(T&&, JobSystem& jobSystem, Args&&...)
+         : promise_type(jobSystem)
+      {
+      }
+
+      JobCoroutine get_return_object()
+      {
+         return JobCoroutine(completion);
+      }
+
+      // Schedule the first step instead of running it on the calling thread
+      auto initial_suspend()
+      {
+         return ResumeAfter{system, completion, std::nullopt};
+      }
+
+      // The frame is destroyed by the last step
+      std::suspend_never final_suspend() noexcept
+      {
+         return {};
+      }
+
+      void return_void()
+      {
+      }
+
+      void unhandled_exception()
+      {
+         std::terminate();
+      }
+
+      auto await_transform(JobHandle dependency)
+      {
+         return ResumeAfter{system, completion, dependency};
+      }
+   };
+
+   // Finished when the coroutine returned
+   JobHandle handle() const
+   {
+      return m_completion;
+   }
+
+private:
+   // Task of the job resuming the coroutine. The coroutine is destroyed
+   // instead if the job is cancelled, and never runs.
+   class Resume
+   {
+   public:
+      explicit Resume(std::coroutine_handle<> coroutine) : m_coroutine(coroutine)
+      {
+      }
+
+      Resume(Resume&& other) : m_coroutine(std::exchange(other.m_coroutine, nullptr))
+      {
+      }
+
+      Resume& operator=(Resume&&) = delete;
+
+      ~Resume()
+      {
+         if (m_coroutine)
+         {
+            m_coroutine.destroy();
+         }
+      }
+
+      void operator()()
+      {
+         std::exchange(m_coroutine, nullptr).resume();
+      }
+
+   private:
+      std::coroutine_handle<> m_coroutine;
+   };
+
+   // Suspend the coroutine, and resume it in a new job, once the dependency
+   // is finished when there is one
+   struct ResumeAfter
+   {
+      JobSystem& system;
+      JobHandle completion;
+      std::optional<JobHandle> dependency;
+
+      bool await_ready()
+      {
+         return dependency.has_value() && system.finished(dependency.value());
+      }
+
+      void await_suspend(std::coroutine_handle<> coroutine)
+      {
+         // Another worker may resume the coroutine, and destroy this awaiter
+         // with its frame, as soon as the job is scheduled
+         JobSystem& jobSystem = system;
+         JobHandle parent = completion;
+         std::optional<JobHandle> after = dependency;
+
+         JobHandle resume = jobSystem.create(Resume(coroutine), parent);
+
+         if (after.has_value())
+         {
+            jobSystem.schedule(resume, after.value());
+         }
+         else
+         {
+            // First step, the completion only finishes with its children
+            jobSystem.schedule(resume);
+            jobSystem.schedule(parent);
+         }
+      }
+
+      void await_resume()
+      {
+      }
+   };
+
+   explicit JobCoroutine(JobHandle completion) : m_completion(completion)
+   {
+   }
+
+   JobHandle m_completion;
+};
@@ -0,0 +1,542 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "blockingconcurrentqueue.h"
+#include "jobsystem.hpp"
+
+// Headers older than 5.6 have io_uring without the read and write operations
+// and the probe. Those are enumerators, the probe flag came with them.
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IO_URING_OP_SUPPORTED)
+#define ECS_HAS_IO_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include <unistd.h>
+
+// Asynchronous file reads and writes completing as jobs. A read or a write
+// returns the handle of a job which finishes once the transfer is done, so
+// jobs processing the data are scheduled after it, and no worker blocks in
+// read(). The data goes straight to or from the given buffer, such as the
+// column of a chunk (see Chunk::column), without intermediate copies.
+//
+// On Linux, requests go through io_uring. Without it, or when the kernel
+// refuses it or lacks the read and write operations (before 5.6), a few I/O
+// threads do blocking pread and pwrite calls instead.
+
+enum class IoOperation : uint8_t
+{
+   Read,
+   Write
+};
+
+// A transfer of size bytes at offset in the file fd. It must stay alive and
+// unchanged until its job finished.
+struct IoRequest
+{
+   int fd = -1;
+   void* buffer = nullptr;
+   size_t size = 0;
+   uint64_t offset = 0;
+
+   // Once the job finished, the number of bytes transferred, less than size
+   // at the end of the file, or -errno
+   int64_t result = 0;
+
+   // Set by JobIO
+   IoOperation operation = IoOperation::Read;
+   JobHandle job{};
+};
+
+enum class IoBackend
+{
+   // io_uring when available, else threads
+   Auto,
+   Threads
+};
+
+struct JobIOConfig
+{
+   IoBackend backend = IoBackend::Auto;
+
+   // Maximum number of io_uring requests in flight, rounded by the kernel
+   uint32_t queueDepth = 256;
+
+   // Number of threads doing blocking calls without io_uring
+   size_t threadCount = 4;
+};
+
+class JobIO
+{
+public:
+   explicit JobIO(JobSystem& jobSystem, const JobIOConfig& config = JobIOConfig())
+      : m_system(jobSystem), m_in_flight(0)
+   {
+#ifdef ECS_HAS_IO_URING
+      if (config.backend == IoBackend::Auto && m_ring.setup(config.queueDepth))
+      {
+         m_threads.emplace_back([this] {
+            ECS_TRACE_THREAD_NAME("io completion");
+            reap();
+         });
+
+         return;
+      }
+#endif
+
+      for (size_t i = 0; i < std::max(config.threadCount, static_cast<size_t>(1)); i++)
+      {
+         m_threads.emplace_back([this] {
+            ECS_TRACE_THREAD_NAME("io");
+            transfer();
+         });
+      }
+   }
+
+   // Wait for the requests in flight, their buffers may be gone afterwards
+   ~JobIO()
+   {
+      while (m_in_flight.load(std::memory_order_acquire) > 0)
+      {
+         std::this_thread::yield();
+      }
+
+#ifdef ECS_HAS_IO_URING
+      if (m_ring.ready())
+      {
+         // A request without job wakes up and stops the completion thread
+         m_ring.submit(IORING_OP_NOP, -1, nullptr, 0, 0, 0);
+         m_threads[0].join();
+         return;
+      }
+#endif
+
+      for (size_t i = 0; i < m_threads.size(); i++)
+      {
+         m_queue.enqueue(nullptr);
+      }
+
+      for (std::thread& thread : m_threads)
+      {
+         thread.join();
+      }
+   }
+
+   JobIO(const JobIO&) = delete;
+   JobIO& operator=(const JobIO&) = delete;
+
+   // Thread safe
+   JobHandle read(IoRequest& request)
+   {
+      request.operation = IoOperation::Read;
+      return submit(request);
+   }
+
+   // Thread safe
+   JobHandle write(IoRequest& request)
+   {
+      request.operation = IoOperation::Write;
+      return submit(request);
+   }
+
+   bool usesIoUring() const
+   {
+#ifdef ECS_HAS_IO_URING
+      return m_ring.ready();
+#else
+      return false;
+#endif
+   }
+
+private:
+#ifdef ECS_HAS_IO_URING
+   // Submission and completion rings shared with the kernel, through the raw
+   // syscalls. Submissions are serialized, a single thread reaps.
+   class Ring
+   {
+   public:
+      ~Ring()
+      {
+         if (m_fd >= 0)
+         {
+            unmap();
+            close(m_fd);
+         }
+      }
+
+      bool setup(uint32_t entries)
+      {
+         io_uring_params params;
+         memset(&params, 0, sizeof(params));
+
+         m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+         if (m_fd < 0)
+         {
+            return false;
+         }
+
+         // Without NODROP, completions beyond the ring are lost. READ and
+         // WRITE came later than NODROP, in 5.6.
+         if (!(params.features & IORING_FEAT_NODROP) || !supports({IORING_OP_READ, IORING_OP_WRITE}))
+         {
+            close(m_fd);
+            m_fd = -1;
+            return false;
+         }
+
+         m_sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+         m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+         m_single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+
+         if (m_single_mmap)
+         {
+            m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+         }
+
+         m_sq = map(m_sq_size, IORING_OFF_SQ_RING);
+         m_cq = m_single_mmap ? m_sq : map(m_cq_size, IORING_OFF_CQ_RING);
+         m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+         m_sqes = static_cast<io_uring_sqe*>(map(m_sqes_size, IORING_OFF_SQES));
+
+         if (m_sq == MAP_FAILED || m_cq == MAP_FAILED || m_sqes == MAP_FAILED)
+         {
+            unmap();
+            close(m_fd);
+            m_fd = -1;
+            return false;
+         }
+
+         m_sq_tail = word(m_sq, params.sq_off.tail);
+         m_sq_mask = *word(m_sq, params.sq_off.ring_mask);
+         m_sq_array = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(m_sq) + params.sq_off.array);
+
+         m_cq_head = word(m_cq, params.cq_off.head);
+         m_cq_tail = word(m_cq, params.cq_off.tail);
+         m_cq_mask = *word(m_cq, params.cq_off.ring_mask);
+         m_cqes = reinterpret_cast<io_uring_cqe*>(static_cast<uint8_t*>(m_cq) + params.cq_off.cqes);
+
+         return true;
+      }
+
+      bool ready() const
+      {
+         return m_fd >= 0;
+      }
+
+      // Return if the kernel supports all the given operations. Kernels
+      // without the probe, older than 5.6, support none of READ and WRITE.
+      bool supports(std::initializer_list<uint8_t> opcodes) const
+      {
+         const unsigned count = 256;
+         std::vector<uint8_t> storage(sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op), 0);
+         io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+
+         if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, count) < 0)
+         {
+            return false;
+         }
+
+         for (uint8_t opcode : opcodes)
+         {
+            if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED))
+            {
+               return false;
+            }
+         }
+
+         return true;
+      }
+
+      // Thread safe. Return 0, or -errno if the kernel refused the request.
+      int submit(uint8_t opcode, int fd, void* buffer, uint32_t size, uint64_t offset, uint64_t data)
+      {
+         while (true)
+         {
+            {
+               std::lock_guard<std::mutex> lock(m_mutex);
+
+               // The kernel consumes each entry in io_uring_enter, the ring is
+               // never full
+               uint32_t tail = m_sq_tail->load(std::memory_order_relaxed);
+               uint32_t index = tail & m_sq_mask;
+
+               io_uring_sqe& sqe = m_sqes[index];
+               memset(&sqe, 0, sizeof(sqe));
+               sqe.opcode = opcode;
+               sqe.fd = fd;
+               sqe.addr = reinterpret_cast<uint64_t>(buffer);
+               sqe.len = size;
+               sqe.off = offset;
+               sqe.user_data = data;
+
+               m_sq_array[index] = index;
+               m_sq_tail->store(tail + 1, std::memory_order_release);
+
+               if (syscall(__NR_io_uring_enter, m_fd, 1, 0, 0, nullptr, 0) >= 0)
+               {
+                  return 0;
+               }
+
+               // Not consumed, take it back
+               m_sq_tail->store(tail, std::memory_order_relaxed);
+
+               if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+               {
+                  return -errno;
+               }
+            }
+
+            // Too many completions not reaped yet, give the completion
+            // thread the lock it may need to resubmit
+            std::this_thread::yield();
+         }
+      }
+
+      // Completion thread only. Sleep until completions are available, and
+      // call complete(data, result) for each one.
+      template<typename F>
+      void reap(F&& complete)
+      {
+         uint32_t head = m_cq_head->load(std::memory_order_relaxed);
+         uint32_t tail = m_cq_tail->load(std::memory_order_acquire);
+
+         if (head == tail)
+         {
+            syscall(__NR_io_uring_enter, m_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            return;
+         }
+
+         for (; head != tail; head++)
+         {
+            const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+            uint64_t data = cqe.user_data;
+            int32_t result = cqe.res;
+
+            // Hand the entry back before completing, which may resubmit
+            m_cq_head->store(head + 1, std::memory_order_release);
+            complete(data, result);
+         }
+      }
+
+   private:
+      int m_fd = -1;
+      std::mutex m_mutex;
+
+      void* m_sq = MAP_FAILED;
+      void* m_cq = MAP_FAILED;
+      size_t m_sq_size = 0;
+      size_t m_cq_size = 0;
+      bool m_single_mmap = false;
+
+      io_uring_sqe* m_sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+      size_t m_sqes_size = 0;
+
+      std::atomic<uint32_t>* m_sq_tail = nullptr;
+      uint32_t m_sq_mask = 0;
+      uint32_t* m_sq_array = nullptr;
+
+      std::atomic<uint32_t>* m_cq_head = nullptr;
+      std::atomic<uint32_t>* m_cq_tail = nullptr;
+      uint32_t m_cq_mask = 0;
+      io_uring_cqe* m_cqes = nullptr;
+
+      void* map(size_t size, off_t offset)
+      {
+         return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+      }
+
+      void unmap()
+      {
+         if (m_sqes != MAP_FAILED)
+         {
+            munmap(m_sqes, m_sqes_size);
+         }
+
+         if (m_cq != MAP_FAILED && !m_single_mmap)
+         {
+            munmap(m_cq, m_cq_size);
+         }
+
+         if (m_sq != MAP_FAILED)
+         {
+            munmap(m_sq, m_sq_size);
+         }
+      }
+
+      static std::atomic<uint32_t>* word(void* ring, uint32_t offset)
+      {
+         static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Ring words are plain 32 bit words");
+         return reinterpret_cast<std::atomic<uint32_t>*>(static_cast<uint8_t*>(ring) + offset);
+      }
+   };
+
+   // Largest transfer of a single entry, longer ones continue as short ones
+   static constexpr size_t MAX_ENTRY_SIZE = size_t(1) << 30;
+
+   Ring m_ring;
+
+   // Submit the part of the request not transferred yet
+   void submit_remaining(IoRequest& request)
+   {
+      size_t done = static_cast<size_t>(request.result);
+      uint32_t size = static_cast<uint32_t>(std::min(request.size - done, MAX_ENTRY_SIZE));
+      uint8_t opcode = request.operation == IoOperation::Read ? IORING_OP_READ : IORING_OP_WRITE;
+
+      int error = m_ring.submit(opcode, request.fd, static_cast<uint8_t*>(request.buffer) + done, size,
+         request.offset + done, reinterpret_cast<uint64_t>(&request));
+
+      if (error < 0)
+      {
+         request.result = error;
+         complete(request);
+      }
+   }
+
+   void reap()
+   {
+      bool running = true;
+
+      while (running)
+      {
+         m_ring.reap([this, &running](uint64_t data, int32_t result) {
+            if (data == 0)
+            {
+               running = false;
+               return;
+            }
+
+            IoRequest& request = *reinterpret_cast<IoRequest*>(data);
+
+            if (result == -EINTR || result == -EAGAIN)
+            {
+               submit_remaining(request);
+            }
+            else if (result < 0)
+            {
+               request.result = result;
+               complete(request);
+            }
+            else if (result > 0 && static_cast<size_t>(request.result + result) < request.size)
+            {
+               // Short transfer, continue where it stopped
+               request.result += result;
+               submit_remaining(request);
+            }
+            else
+            {
+               request.result += result;
+               complete(request);
+            }
+         });
+      }
+   }
+#endif
+
+   JobSystem& m_system;
+
+   // Requests submitted and not completed yet
+   std::atomic<size_t> m_in_flight;
+
+   // Requests for the I/O threads, nullptr stops one of them
+   moodycamel::BlockingConcurrentQueue<IoRequest*> m_queue;
+
+   std::vector<std::thread> m_threads;
+
+   JobHandle submit(IoRequest& request)
+   {
+      request.result = 0;
+      request.job = m_system.create([] {});
+
+      m_in_flight.fetch_add(1, std::memory_order_relaxed);
+      m_system.schedule_external(request.job);
+
+#ifdef ECS_HAS_IO_URING
+      if (m_ring.ready())
+      {
+         // The completion thread may finish the job and the caller reuse the
+         // request as soon as it is submitted
+         JobHandle job = request.job;
+         submit_remaining(request);
+         return job;
+      }
+#endif
+
+      m_queue.enqueue(&request);
+      return request.job;
+   }
+
+   // Run the requests with blocking calls, until stopped
+   void transfer()
+   {
+      IoRequest* request;
+
+      while (true)
+      {
+         m_queue.wait_dequeue(request);
+
+         if (request == nullptr)
+         {
+            return;
+         }
+
+         ECS_TRACE_BEGIN("io");
+
+         uint8_t* buffer = static_cast<uint8_t*>(request->buffer);
+         size_t done = 0;
+         int64_t result = 0;
+
+         while (done < request->size)
+         {
+            ssize_t count = request->operation == IoOperation::Read
+               ? pread(request->fd, buffer + done, request->size - done, static_cast<off_t>(request->offset + done))
+               : pwrite(request->fd, buffer + done, request->size - done, static_cast<off_t>(request->offset + done));
+
+            if (count < 0 && errno == EINTR)
+            {
+               continue;
+            }
+
+            if (count < 0)
+            {
+               result = -errno;
+               break;
+            }
+
+            if (count == 0)
+            {
+               // End of the file
+               break;
+            }
+
+            done += static_cast<size_t>(count);
+            result = static_cast<int64_t>(done);
+         }
+
+         request->result = result;
+
+         ECS_TRACE_END("io");
+
+         complete(*request);
+      }
+   }
+
+   // Release the job of the request, its dependents may start
+   void complete(IoRequest& request)
+   {
+      m_system.release_external(request.job);
+      m_in_flight.fetch_sub(1, std::memory_order_release);
+   }
+};
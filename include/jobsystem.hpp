@@ -2,14 +2,28 @@
 
 #include <thread>
 #include <atomic>
-#include <functional>
 #include <algorithm>
+#include <array>
+#include <type_traits>
+#include <new>
+#include <initializer_list>
 #include <optional>
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <chrono>
+#include <mutex>
+#include <random>
 
 #include "concurrentqueue.h"
-#include "blockingconcurrentqueue.h"
+#include "workstealingdeque.hpp"
+#include "futex.hpp"
+#include "topology.hpp"
+#include "timerwheel.hpp"
+#include "jobtrace.hpp"
 
-using Version = size_t;
+// 32 bits so that threads can park on it, see futexWait
+using Version = uint32_t;
 
 using JobId = size_t;
 
@@ -19,264 +33,2366 @@ struct JobHandle
    Version version;
 };
 
-class JobPool
+// Ready jobs are queued per priority, and workers drain the higher
+// priorities first. Long running jobs (pathfinding, streaming...) have their
+// own lane, which only some of the workers take from at a time, see
+// JobSystemConfig::longRunningWorkers. MainThread jobs (graphics API calls,
+// some OS calls...) only run on the thread which created the job system,
+// while it waits on jobs or pumps them, see JobSystem::pump.
+enum class JobPriority : uint8_t
+{
+   High,
+   Normal,
+   Low,
+   LongRunning,
+   MainThread
+};
+
+// Number of priorities with their own queues, lanes excluded
+constexpr size_t PRIORITY_LEVELS = 3;
+
+// A void() callable stored inline, so creating a job never allocates.
+// Callables bigger than CAPACITY are rejected at compile time: capture
+// references, or a pointer to the bigger state, instead.
+class JobTask
 {
 public:
-   JobPool() : m_pool(new std::array<Job, POOL_SIZE>()), m_version(new std::array<std::atomic<size_t>, POOL_SIZE>())
+   // One cache line
+   static constexpr size_t CAPACITY = 64;
+
+   JobTask() = default;
+
+   JobTask(const JobTask&) = delete;
+   JobTask& operator=(const JobTask&) = delete;
+
+   ~JobTask()
+   {
+      reset();
+   }
+
+   // Store a new callable, destroying the previous one
+   template<typename F>
+   void emplace(F&& func)
+   {
+      using Function = std::decay_t<F>;
+
+      static_assert(sizeof(Function) <= CAPACITY, "Job task captures too much, it must fit in JobTask::CAPACITY");
+      static_assert(alignof(Function) <= alignof(std::max_align_t), "Job task is over aligned");
+      static_assert(std::is_invocable_r_v<void, Function&>, "Job task must be callable as void()");
+
+      reset();
+
+      new (m_storage) Function(std::forward<F>(func));
+      m_invoke = [](void* storage) { (*static_cast<Function*>(storage))(); };
+      m_destroy = [](void* storage) { static_cast<Function*>(storage)->~Function(); };
+   }
+
+   void operator()()
    {
-      std::vector<size_t> available(POOL_SIZE);
+      assert(m_invoke != nullptr);
+      m_invoke(m_storage);
+   }
 
-      for (size_t i = 0; i < POOL_SIZE; ++i)
+   // Destroy the stored callable, releasing what it captured
+   void reset()
+   {
+      if (m_destroy != nullptr)
       {
-         available[i] = i;
+         m_destroy(m_storage);
+         m_invoke = nullptr;
+         m_destroy = nullptr;
       }
+   }
+
+private:
+   alignas(std::max_align_t) unsigned char m_storage[CAPACITY];
+   void (*m_invoke)(void*) = nullptr;
+   void (*m_destroy)(void*) = nullptr;
+};
+
+class JobPool
+{
+public:
+   // Number of dependencies a job can be linked to, JobSystem::schedule
+   // uses relay jobs for more
+   static constexpr size_t MAX_DEPENDENCIES = 8;
+
+   // Free job ids kept by one thread, so that it rarely touches the shared
+   // free list. Only used by its thread.
+   struct Cache
+   {
+      static constexpr size_t CAPACITY = 64;
 
-      // Fill the queue with the current available ids, which are all ids
-      m_available.enqueue_bulk(available.begin(), POOL_SIZE);
+      std::array<JobId, CAPACITY> ids;
+      size_t count = 0;
    };
 
-   // Thread safe
-   bool create(std::function<void()>&& task, JobHandle& handle)
+   // Jobs are allocated by segments of SEGMENT_SIZE, when the free ones run
+   // out, up to MAX_JOBS
+   static constexpr size_t SEGMENT_SIZE = 1024;
+   static constexpr size_t MAX_JOBS = size_t(1) << 20;
+
+   JobPool() : m_segment_count(0), m_waiters(0)
+   {
+      grow();
+   }
+
+   ~JobPool()
+   {
+      for (size_t i = 0; i < m_segment_count.load(std::memory_order_relaxed); i++)
+      {
+         delete m_segments[i].load(std::memory_order_relaxed);
+      }
+   }
+
+   JobPool(const JobPool&) = delete;
+   JobPool& operator=(const JobPool&) = delete;
+
+   // Thread safe, with the cache of the calling thread or nullptr
+   // The task is only consumed when the job is created
+   template<typename F>
+   bool create(F&& task, JobHandle& handle, JobPriority priority, Cache* cache)
    {
-      size_t next_free;
+      JobId next_free;
 
-      if (!m_available.try_dequeue(next_free))
+      if (!acquire(next_free, cache))
       {
          return false;
       }
 
       handle.id = next_free;
-      handle.version = (*m_version)[next_free].load(std::memory_order_relaxed);
+      handle.version = versionAt(next_free).load(std::memory_order_relaxed);
 
-      (*m_pool)[next_free].init(std::move(task));
+      jobAt(next_free).init(std::forward<F>(task), handle.version, priority);
 
       return true;
    }
 
-   // Thread safe
-   bool create(std::function<void()>&& task, JobHandle& handle, JobHandle parent)
+   // Thread safe, with the cache of the calling thread or nullptr
+   template<typename F>
+   bool create(F&& task, JobHandle& handle, JobHandle parent, JobPriority priority, Cache* cache)
    {
-      size_t next_free;
+      JobId next_free;
 
-      if (!m_available.try_dequeue(next_free))
+      if (!acquire(next_free, cache))
       {
          return false;
       }
 
       handle.id = next_free;
-      handle.version = (*m_version)[next_free].load(std::memory_order_relaxed);
+      handle.version = versionAt(next_free).load(std::memory_order_relaxed);
 
-      (*m_pool)[next_free].init(std::move(task), parent);
+      jobAt(next_free).init(std::forward<F>(task), handle.version, priority, parent);
 
       // This is not very safe, the user is resonsible of scheduling the parent after children
-      (*m_pool)[parent.id].m_unfinished.fetch_add(1, std::memory_order_relaxed);
+      jobAt(parent.id).m_unfinished.fetch_add(1, std::memory_order_relaxed);
+
+      return true;
+   }
+
+   // Give the ids of a cache back to the shared free list, before the thread
+   // owning it stops
+   void flush(Cache& cache)
+   {
+      m_available.enqueue_bulk(cache.ids.begin(), cache.count);
+      cache.count = 0;
+   }
+
+   // Number of jobs allocated, used or not
+   size_t capacity() const
+   {
+      return m_segment_count.load(std::memory_order_acquire) * SEGMENT_SIZE;
+   }
+
+   // Thread safe
+   // Register the given job to be released by the dependency when it
+   // finishes, using one of its dependency links. Return false if the
+   // dependency is already finished: it will not release the continuation.
+   bool addContinuation(JobHandle dependency, JobId continuation, size_t link)
+   {
+      assert(link < MAX_DEPENDENCIES);
+
+      std::atomic<uint64_t>& head = jobAt(dependency.id).m_continuations;
+      LinkRef ref = static_cast<LinkRef>(continuation * MAX_DEPENDENCIES + link);
+      uint64_t current = head.load(std::memory_order_acquire);
+
+      do
+      {
+         // The list is closed when the dependency finished, and its version
+         // changed if the job was reused since
+         if (headVersion(current) != static_cast<uint32_t>(dependency.version) || headLink(current) == CLOSED)
+         {
+            return false;
+         }
+
+         jobAt(continuation).m_links[link] = headLink(current);
+      }
+      while (!head.compare_exchange_weak(current, makeHead(dependency.version, ref),
+               std::memory_order_acq_rel, std::memory_order_acquire));
 
       return true;
    }
 
-   void addContinuation(JobHandle parent, JobHandle continuation)
+   // Keep the slot and the task of the job once it is finished, so that it
+   // can run again, see reopen
+   void setPersistent(JobId id)
+   {
+      jobAt(id).m_persistent = true;
+   }
+
+   // Not thread safe, the jobs must not be running
+   // Register a continuation released every time the persistent dependency
+   // finishes, using one of its dependency links
+   void addStaticContinuation(JobId dependency, JobId continuation, size_t link)
+   {
+      assert(link < MAX_DEPENDENCIES);
+
+      Job& job = jobAt(dependency);
+      jobAt(continuation).m_links[link] = job.m_static_head;
+      job.m_static_head = static_cast<LinkRef>(continuation * MAX_DEPENDENCIES + link);
+   }
+
+   // Not thread safe, the job must not be running
+   // Prepare a persistent job to run again, with its static continuations,
+   // and return its handle for this run
+   JobHandle reopen(JobId id, uint32_t dependencies, size_t unfinished)
+   {
+      Job& job = jobAt(id);
+      Version version = versionAt(id).load(std::memory_order_relaxed);
+
+      job.m_unfinished.store(unfinished, std::memory_order_relaxed);
+      job.m_dependencies.store(dependencies, std::memory_order_relaxed);
+      job.m_continuations.store(makeHead(version, job.m_static_head), std::memory_order_release);
+
+      return {id, version};
+   }
+
+   // Not thread safe, the job must not be running
+   // Give the slot of a persistent job back to the pool
+   void releasePersistent(JobId id)
+   {
+      Job& job = jobAt(id);
+      job.m_task.reset();
+      job.m_persistent = false;
+
+      // Handles of the job are finished even if it never ran
+      versionAt(id).fetch_add(1, std::memory_order_seq_cst);
+      m_available.enqueue(id);
+   }
+
+#ifdef ECS_JOB_TRACING
+   // Name of the job in traces, must outlive the trace
+   void setName(JobId id, const char* name)
    {
-      (*m_pool)[parent.id].m_continuations.push_back(continuation);
+      jobAt(id).m_name = name;
    }
 
-   // Thread safe for a given handle
-   // Should not be called from 2 threads with the same handle.id
-   // Return the jobs that can be scheduled
-   std::vector<JobHandle> invoke(JobHandle handle)
+   const char* name(JobId id) const
    {
-      std::vector<JobHandle> continuations;
+      return jobAt(id).m_name;
+   }
+#endif
 
-      // First run the task associated to this handle
-      (*m_pool)[handle.id].m_task();
+   // Thread safe, until the job is finished
+   JobPriority priority(JobId id) const
+   {
+      return jobAt(id).m_priority;
+   }
 
-      finish(handle, continuations);
+   // Set the number of releases needed before the job can be scheduled
+   void setDependencies(JobId id, uint32_t count)
+   {
+      jobAt(id).m_dependencies.store(count, std::memory_order_relaxed);
+   }
 
-      return continuations;
+   // Thread safe
+   // Return true if this was the last dependency, the job can be scheduled
+   bool releaseDependency(JobId id)
+   {
+      return jobAt(id).m_dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1;
    }
 
-   void finish(JobHandle handle, std::vector<JobHandle>& continuations)
+   // Thread safe for a given id
+   // Should not be called from 2 threads with the same id
+   // ready(JobId) is called with each job that can be scheduled, the id of
+   // the job goes to cache when given
+   template<typename F>
+   void invoke(JobId id, F&& ready, Cache* cache)
    {
-      Job& job = (*m_pool)[handle.id];
-      job.m_unfinished.fetch_sub(1, std::memory_order_release);
+      // First run the task associated to this id, unless cancelled, and
+      // release its captures unless it runs again
+      Job& job = jobAt(id);
+
+      if (!cancelled(id))
+      {
+         job.m_task();
+      }
 
-      if (job.m_parent.has_value())
+      if (!job.m_persistent)
       {
-         finish(job.m_parent.value(), continuations);
+         job.m_task.reset();
       }
 
-      if (job.m_unfinished.load(std::memory_order_acquire) <= 0)
+      finish(id, ready, cache);
+   }
+
+   // Finish the job, and its parents once all their children are finished
+   template<typename F>
+   void finish(JobId id, F& ready, Cache* cache)
+   {
+      while (true)
       {
+         Job& job = jobAt(id);
+
+         // The parent only counts this job once, when it and all its
+         // children are finished
+         if (job.m_unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+         {
+            return;
+         }
+
+         std::optional<JobHandle> parent = job.m_parent;
+         Version version = versionAt(id).load(std::memory_order_relaxed);
+
+         // Close the continuation list, no continuation can be added after
+         // this
+         uint64_t head = job.m_continuations.exchange(makeHead(version, CLOSED), std::memory_order_acq_rel);
+         LinkRef ref = headLink(head);
+
+         bool persistent = job.m_persistent;
+
          // Invalidate this job by incrementing the version in the m_version
-         // This also indicates that the job is finished
-         (*m_version)[handle.id].fetch_add(1, std::memory_order_release);
+         // This also indicates that the job is finished, before any
+         // continuation starts and may look at it
+         versionAt(id).fetch_add(1, std::memory_order_seq_cst);
+
+         if (m_waiters.load(std::memory_order_seq_cst) > 0)
+         {
+            futexWake(versionAt(id));
+         }
+
+         // Hand over the continuations whose dependencies are all released
+         while (ref != NO_LINK)
+         {
+            JobId continuation = ref / MAX_DEPENDENCIES;
+
+            // Read the next link first, the continuation may be reused as
+            // soon as it is released
+            LinkRef next = jobAt(continuation).m_links[ref % MAX_DEPENDENCIES];
+
+            if (releaseDependency(continuation))
+            {
+               ready(continuation);
+            }
+
+            ref = next;
+         }
+
+         // And add the fact that this id is now available to use by another
+         // job, persistent ones keep it until released
+         if (!persistent)
+         {
+            recycle(id, cache);
+         }
+
+         if (!parent.has_value())
+         {
+            return;
+         }
+
+         id = parent.value().id;
+      }
+   }
+
+   // Thread safe
+   // No effect once the job is finished
+   void cancel(JobHandle handle)
+   {
+      if (!finished(handle))
+      {
+         jobAt(handle.id).m_cancelled.store(handle.version, std::memory_order_relaxed);
+      }
+   }
+
+   // Thread safe, until the job is finished
+   // Return if the job, or one of its ancestors, is cancelled. Parents are
+   // not finished before their children, so they can be read.
+   bool cancelled(JobId id)
+   {
+      while (true)
+      {
+         Job& job = jobAt(id);
+
+         if (job.m_cancelled.load(std::memory_order_relaxed) == versionAt(id).load(std::memory_order_relaxed))
+         {
+            return true;
+         }
 
-         // We call this now, because by adding 1 to the version, we are sure that finished returns true
-         // this means that it is safe to get the registration now. But BEFORE adding handle.id to the queue
-         // to not take the continuation of another handle.
-         std::vector<JobHandle> newContinuations = job.m_continuations;
-         continuations.insert(continuations.end(), newContinuations.begin(), newContinuations.end());
+         if (!job.m_parent.has_value())
+         {
+            return false;
+         }
 
-         // And add the fact that this id is now available to use by another job
-         m_available.enqueue(handle.id);
+         id = job.m_parent.value().id;
       }
    }
 
    // Thread safe
    bool finished(JobHandle handle)
    {
-      // A job is finished when it has been released calling invoke
-      return handle.version < (*m_version)[handle.id].load(std::memory_order_acquire);
+      // A job is finished when it has been released calling invoke, the
+      // version only changes then
+      return handle.version != versionAt(handle.id).load(std::memory_order_acquire);
+   }
+
+   // Thread safe
+   // Sleep until the job is finished or the timeout expired, unless
+   // canSleep, called with the word slept on, returns false
+   template<typename F>
+   void park(JobHandle handle, std::chrono::microseconds timeout, F&& canSleep)
+   {
+      m_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+      // Only sleeps if the version is still the one of the handle
+      std::atomic<Version>& word = versionAt(handle.id);
+      if (canSleep(word))
+      {
+         futexWait(word, handle.version, timeout);
+      }
+
+      m_waiters.fetch_sub(1, std::memory_order_relaxed);
    }
 
 private:
+   // A link of a job in a continuation list: id * MAX_DEPENDENCIES + link
+   using LinkRef = uint32_t;
+
+   // End of a continuation list
+   static constexpr LinkRef NO_LINK = 0xFFFFFFFF;
+
+   // Continuation list of a finished job
+   static constexpr LinkRef CLOSED = 0xFFFFFFFE;
+
    struct Job {
-      std::function<void()> m_task;
+      JobTask m_task;
       
       // Parent of this job
       // The parent is finished when all its children are finished
       std::optional<JobHandle> m_parent;
       std::atomic<size_t> m_unfinished;
 
-      // Jobs that should be executed when this job is finised
-      std::vector<JobHandle> m_continuations;
+      // Jobs that should be released when this job is finised, as a lock
+      // free list of their links. Holds the job version in its high bits.
+      std::atomic<uint64_t> m_continuations;
+
+      // Links of this job in the continuation lists of its dependencies
+      std::array<LinkRef, MAX_DEPENDENCIES> m_links;
+
+      // Number of releases needed before this job can be scheduled
+      std::atomic<uint32_t> m_dependencies;
+
+      // Queue the job is pushed to once ready
+      JobPriority m_priority;
 
-      void init(std::function<void()>&& task)
+      // Persistent jobs are not given back to the pool when finished, and
+      // restore their static continuations when reopened
+      bool m_persistent;
+      LinkRef m_static_head;
+
+#ifdef ECS_JOB_TRACING
+      const char* m_name;
+#endif
+
+      // Version of the job when cancelled, so that a late cancel of a
+      // previous use of the slot has no effect
+      std::atomic<Version> m_cancelled;
+
+      template<typename F>
+      void init(F&& task, Version version, JobPriority priority)
       {
-         m_task = std::move(task);
+         m_task.emplace(std::forward<F>(task));
+         m_priority = priority;
+         m_persistent = false;
+         m_static_head = NO_LINK;
+#ifdef ECS_JOB_TRACING
+         m_name = "job";
+#endif
          m_parent = std::nullopt;
+         m_cancelled.store(version - 1, std::memory_order_relaxed);
          m_unfinished.store(1, std::memory_order_relaxed);
-         m_continuations.clear();
+         m_continuations.store(makeHead(version, NO_LINK), std::memory_order_release);
       }
 
-      void init(std::function<void()>&& task, JobHandle parent)
+      template<typename F>
+      void init(F&& task, Version version, JobPriority priority, JobHandle parent)
       {
-         init(std::move(task));
+         init(std::forward<F>(task), version, priority);
          m_parent = parent;
       }
    };
 
-   static constexpr size_t POOL_SIZE = 65536;
-   std::unique_ptr<std::array<Job, POOL_SIZE>> m_pool;
-   std::unique_ptr<std::array<std::atomic<size_t>, POOL_SIZE>> m_version;
-   moodycamel::ConcurrentQueue<size_t> m_available;
+   Job& jobAt(JobId id)
+   {
+      return m_segments[id / SEGMENT_SIZE].load(std::memory_order_acquire)->jobs[id % SEGMENT_SIZE];
+   }
 
-};
+   const Job& jobAt(JobId id) const
+   {
+      return m_segments[id / SEGMENT_SIZE].load(std::memory_order_acquire)->jobs[id % SEGMENT_SIZE];
+   }
 
-class JobSystem
-{
-public:
-   JobSystem() : m_pending(0)
+   std::atomic<Version>& versionAt(JobId id)
    {
-      const size_t thread_count = std::max(static_cast<unsigned int>(1), std::thread::hardware_concurrency() - 1);
-      m_wokers.reserve(thread_count);
+      return m_segments[id / SEGMENT_SIZE].load(std::memory_order_acquire)->versions[id % SEGMENT_SIZE];
+   }
 
-      for (size_t i = 0; i < thread_count; i++)
+   // Take a free id: from the cache, refilled from the shared list, which
+   // is refilled with a new segment. Return false once MAX_JOBS are used.
+   bool acquire(JobId& id, Cache* cache)
+   {
+      if (cache == nullptr)
       {
-         m_wokers.emplace_back([this] {
-            JobHandle job;
-
-            while (true)
+         while (!m_available.try_dequeue(id))
+         {
+            if (!grow())
             {
-               m_ready_queue.wait_dequeue(job);
-               work_one(job);
+               return false;
             }
-         });
-         m_wokers[i].detach();
+         }
+
+         return true;
       }
-   }
 
-   // Create a task (do not schedule it)
-   JobHandle create(std::function<void()>&& task)
-   {
-      JobHandle handle;
-      while (!m_job_pool.create(std::move(task), handle))
+      while (cache->count == 0)
       {
-         // Work until the job pool can get a new job
-         try_work();
+         cache->count = m_available.try_dequeue_bulk(cache->ids.begin(), Cache::CAPACITY / 2);
+
+         if (cache->count == 0 && !grow())
+         {
+            return false;
+         }
       }
 
-      return handle;
+      id = cache->ids[--cache->count];
+      return true;
    }
 
-   // Create a new task with a given parent.
-   // The parent is not a dependency, it is meant to be used if you want to wait on multiple jobs
-   // wait(parent) will wait that all childs are finished
-   JobHandle create(std::function<void()>&& task, JobHandle parent)
+   // Give a free id back, to the cache when there is room
+   void recycle(JobId id, Cache* cache)
    {
-      JobHandle handle;
-      while (!m_job_pool.create(std::move(task), handle, parent))
+      if (cache == nullptr)
       {
-         // Work until the job pool can get a new job
-         try_work();
+         m_available.enqueue(id);
+         return;
       }
 
-      return handle;
-   }
+      if (cache->count == Cache::CAPACITY)
+      {
+         // Share the older half
+         m_available.enqueue_bulk(cache->ids.begin(), Cache::CAPACITY / 2);
+         std::copy(cache->ids.begin() + Cache::CAPACITY / 2, cache->ids.end(), cache->ids.begin());
+         cache->count -= Cache::CAPACITY / 2;
+      }
 
-   void schedule(JobHandle handle)
-   {
-      m_ready_queue.enqueue(handle);
-      m_pending.fetch_add(1, std::memory_order_release);
+      cache->ids[cache->count++] = id;
    }
 
-   void schedule(JobHandle handle, JobHandle dependency)
+   // Add a segment of free jobs, unless another thread just did or the pool
+   // is full. Return false if there is no new free job.
+   bool grow()
    {
-      if (m_job_pool.finished(dependency))
+      std::lock_guard<std::mutex> lock(m_grow_mutex);
+
+      if (m_available.size_approx() > 0)
       {
-         m_ready_queue.enqueue(handle);
+         return true;
       }
-      else
+
+      size_t count = m_segment_count.load(std::memory_order_relaxed);
+      if (count == MAX_SEGMENTS)
       {
-         m_job_pool.addContinuation(dependency, handle);
+         return false;
       }
 
-      m_pending.fetch_add(1, std::memory_order_release);
-   }
+      m_segments[count].store(new Segment(), std::memory_order_release);
+      m_segment_count.store(count + 1, std::memory_order_release);
 
-   void wait(JobHandle job)
-   {
-      while (!m_job_pool.finished(job))
+      std::array<JobId, SEGMENT_SIZE> ids;
+      for (size_t i = 0; i < SEGMENT_SIZE; i++)
       {
-         // Work until the the given job is finised
-         try_work();
+         ids[i] = count * SEGMENT_SIZE + i;
       }
+
+      m_available.enqueue_bulk(ids.begin(), SEGMENT_SIZE);
+
+      return true;
    }
 
-   void waitAll()
+   // Head of a continuation list: the job version in the high bits, and the
+   // first link in the low bits
+   static uint64_t makeHead(Version version, LinkRef link)
    {
-      while (m_pending.load(std::memory_order_acquire) > 0)
-      {
-         // Work until all jobs are done
-         try_work();
-      }
+      return (static_cast<uint64_t>(static_cast<uint32_t>(version)) << 32) | link;
    }
 
-private:
-   moodycamel::BlockingConcurrentQueue<JobHandle> m_ready_queue;
-   std::atomic<int> m_pending;
+   static uint32_t headVersion(uint64_t head)
+   {
+      return static_cast<uint32_t>(head >> 32);
+   }
 
-   std::vector<std::thread> m_wokers;
+   static LinkRef headLink(uint64_t head)
+   {
+      return static_cast<LinkRef>(head);
+   }
 
-   JobPool m_job_pool;
+   struct Segment
+   {
+      std::array<Job, SEGMENT_SIZE> jobs;
+      std::array<std::atomic<Version>, SEGMENT_SIZE> versions{};
+   };
 
-   void try_work()
+   static constexpr size_t MAX_SEGMENTS = MAX_JOBS / SEGMENT_SIZE;
+
+   static_assert(MAX_JOBS * MAX_DEPENDENCIES < CLOSED, "Job links must fit in a LinkRef");
+
+   // Segments are never freed before the pool, so a job stays at the same
+   // address once allocated
+   std::array<std::atomic<Segment*>, MAX_SEGMENTS> m_segments{};
+   std::atomic<size_t> m_segment_count;
+   std::mutex m_grow_mutex;
+
+   // Free job ids shared by all threads
+   moodycamel::ConcurrentQueue<JobId> m_available;
+
+   // Number of threads parked on a version, finish only wakes them if any
+   std::atomic<uint32_t> m_waiters;
+
+};
+
+// How a thread without work waits before parking: it first retries right
+// away spinCount times, then pauses the CPU between pauseCount retries, then
+// yields yieldCount times, and finally sleeps until woken or parkTimeout.
+struct BackoffPolicy
+{
+   uint32_t spinCount = 32;
+   uint32_t pauseCount = 256;
+   uint32_t yieldCount = 16;
+   std::chrono::microseconds parkTimeout{100000};
+};
+
+class Backoff
+{
+public:
+   explicit Backoff(const BackoffPolicy& policy) : m_policy(policy), m_step(0)
+   {
+   }
+
+   // Wait a little before the next attempt. Return false once the thread
+   // should park instead.
+   bool step()
    {
-      JobHandle job;
-      if (m_ready_queue.try_dequeue(job))
+      if (m_step < m_policy.spinCount)
       {
-         work_one(job);
       }
-      else
+      else if (m_step < m_policy.spinCount + m_policy.pauseCount)
+      {
+         cpuPause();
+      }
+      else if (m_step < m_policy.spinCount + m_policy.pauseCount + m_policy.yieldCount)
       {
          std::this_thread::yield();
       }
+      else
+      {
+         return false;
+      }
+
+      m_step++;
+      return true;
    }
 
-   void work_one(JobHandle job)
+   // Work was found, start over from spinning
+   void reset()
+   {
+      m_step = 0;
+   }
+
+private:
+   const BackoffPolicy& m_policy;
+   uint32_t m_step;
+};
+
+// Placement of the workers on the CPUs
+struct AffinityPolicy
+{
+   // Pin each worker to a single CPU
+   bool pinWorkers = false;
+
+   // Place the workers node after node, bind each one to the CPUs of its
+   // NUMA node, and steal from workers of the same node first. Memory
+   // allocated by a worker, such as the chunks it creates, then lands on its
+   // node with the first touch policy of the kernel. Chunks created by
+   // another thread stay on its node until moved with Chunk::relocate from
+   // a job of the worker processing them.
+   bool numaAware = false;
+};
+
+enum class ExecutionMode
+{
+   // No worker, jobs run on the threads waiting on them, in the order they
+   // are ready. Deterministic when a single thread uses the job system.
+   Inline,
+
+   // A single worker runs all the jobs, waiting threads only wait. A serial
+   // baseline going through the same code as Parallel.
+   SingleWorker,
+
+   // workerCount workers, and the waiting threads, run the jobs
+   Parallel
+};
+
+struct JobSystemConfig
+{
+   ExecutionMode mode = ExecutionMode::Parallel;
+
+   // Parallel mode only, 0 for one worker per hardware thread, minus the
+   // calling thread
+   size_t workerCount = 0;
+
+   // Run the ready jobs in a pseudo random order drawn from this seed,
+   // ignoring priorities. The order is reproducible in Inline mode, with
+   // workers it shakes the scheduling to expose ordering bugs.
+   std::optional<uint64_t> seed;
+
+   BackoffPolicy backoff;
+
+   AffinityPolicy affinity;
+
+   // Maximum number of workers running LongRunning jobs at the same time, so
+   // that the others stay available for the other priorities. 0 for all the
+   // workers but one.
+   size_t longRunningWorkers = 0;
+};
+
+// Counters of a thread running jobs, see JobSystem::stats. Times are in
+// nanoseconds, waits inside jobs count as spinning or idle, not busy.
+struct WorkerStats
+{
+   uint64_t executed = 0;
+
+   // Jobs taken from the deque of another worker
+   uint64_t stolen = 0;
+
+   // Running jobs, backing off without work, and parked
+   uint64_t busyTime = 0;
+   uint64_t spinTime = 0;
+   uint64_t idleTime = 0;
+
+   // Maximum number of jobs seen in the deque of the worker
+   uint64_t queueHighWater = 0;
+};
+
+struct JobSystemStats
+{
+   std::vector<WorkerStats> workers;
+
+   // Threads which are not workers, while they wait on jobs
+   WorkerStats external;
+
+   // Number of times a job could not be created until another one finished,
+   // as the pool reached JobPool::MAX_JOBS
+   uint64_t poolExhausted = 0;
+};
+
+// Workers which ran each range of a parallel_for, so that the next one with
+// the same affinity runs every range on the same worker again, while its
+// data, such as a chunk, is still in the caches of that worker. Keep one per
+// loop run every frame, for instance per system.
+class JobAffinity
+{
+public:
+   // Forget the workers, ranges are spread again
+   void reset()
    {
-      std::vector<JobHandle> continuations = m_job_pool.invoke(job);
-      m_pending.fetch_add(-1, std::memory_order_release);
+      m_workers.clear();
+   }
+
+private:
+   friend class JobSystem;
 
-      m_ready_queue.enqueue_bulk(continuations.data(), continuations.size());
+   std::vector<size_t> m_workers;
+};
+
+class JobSystem
+{
+   friend class JobGraph;
+   friend class JobIO;
+
+public:
+   JobSystem() : JobSystem(JobSystemConfig())
+   {
+   }
+
+   explicit JobSystem(size_t thread_count) : JobSystem([thread_count] {
+         JobSystemConfig config;
+         config.workerCount = thread_count;
+         return config;
+      }())
+   {
+   }
+
+   explicit JobSystem(const JobSystemConfig& config)
+      : m_long_running(0), m_long_running_workers(config.longRunningWorkers), m_long_running_limit(0),
+        m_pending(0), m_pending_waiters(0), m_running(false), m_sleeping(0), m_work_epoch(0),
+        m_mode(config.mode), m_backoff(config.backoff), m_affinity(config.affinity), m_topology(readCpuTopology())
+   {
+      if (config.seed.has_value())
+      {
+         m_shuffle.reset(new Shuffle());
+         m_shuffle->random.seed(config.seed.value());
+      }
+
+      start_workers(workerCountOf(config));
+   }
+
+   ~JobSystem()
+   {
+      shutdown();
+   }
+
+   JobSystem(const JobSystem&) = delete;
+   JobSystem& operator=(const JobSystem&) = delete;
+
+   // Run all scheduled jobs, then stop and join the workers. Jobs scheduled
+   // afterwards only run when a thread waits on them.
+   // Not thread safe, must not be called from a job.
+   void shutdown()
+   {
+      waitAll();
+      stop_workers();
+   }
+
+   // Change the number of workers, after running all scheduled jobs.
+   // Parallel mode only. Not thread safe, must not be called from a job.
+   void resize(size_t thread_count)
+   {
+      assert(m_mode == ExecutionMode::Parallel && thread_count > 0);
+
+      shutdown();
+      start_workers(thread_count);
+   }
+
+   // Create a task (do not schedule it)
+   // The task is stored inline in the job, see JobTask
+   template<typename F>
+   JobHandle create(F&& task, JobPriority priority = JobPriority::Normal)
+   {
+      JobHandle handle;
+      if (!m_job_pool.create(std::forward<F>(task), handle, priority, local_cache()))
+      {
+         m_pool_exhausted.fetch_add(1, std::memory_order_relaxed);
+
+         // Work until the job pool can get a new job
+         do
+         {
+            try_work();
+         }
+         while (!m_job_pool.create(std::forward<F>(task), handle, priority, local_cache()));
+      }
+
+      return handle;
+   }
+
+   // Create a new task with a given parent.
+   // The parent is not a dependency, it is meant to be used if you want to wait on multiple jobs
+   // wait(parent) will wait that all childs are finished
+   template<typename F>
+   JobHandle create(F&& task, JobHandle parent, JobPriority priority = JobPriority::Normal)
+   {
+      JobHandle handle;
+      if (!m_job_pool.create(std::forward<F>(task), handle, parent, priority, local_cache()))
+      {
+         m_pool_exhausted.fetch_add(1, std::memory_order_relaxed);
+
+         // Work until the job pool can get a new job
+         do
+         {
+            try_work();
+         }
+         while (!m_job_pool.create(std::forward<F>(task), handle, parent, priority, local_cache()));
+      }
+
+      return handle;
+   }
+
+   // Name the job in traces, see jobtrace.hpp. The name must outlive the
+   // trace, such as a string literal. Does nothing unless ECS_JOB_TRACING is
+   // defined.
+   void setName(JobHandle handle, const char* name)
+   {
+#ifdef ECS_JOB_TRACING
+      m_job_pool.setName(handle.id, name);
+#else
+      (void) handle;
+      (void) name;
+#endif
+   }
+
+   void schedule(JobHandle handle)
+   {
+      m_pending.fetch_add(1, std::memory_order_release);
+      push_ready(handle.id);
+   }
+
+   void schedule(JobHandle handle, JobHandle dependency)
+   {
+      schedule(handle, &dependency, 1);
+   }
+
+   // Schedule the job once all the given dependencies are finished
+   void schedule(JobHandle handle, std::initializer_list<JobHandle> dependencies)
+   {
+      schedule(handle, dependencies.begin(), dependencies.size());
+   }
+
+   // Schedule the job once all the given dependencies are finished
+   void schedule(JobHandle handle, const JobHandle* dependencies, size_t count)
+   {
+      if (count > JobPool::MAX_DEPENDENCIES)
+      {
+         // Not enough links in the job, wait on the last dependencies through
+         // an empty relay job
+         size_t direct = JobPool::MAX_DEPENDENCIES - 1;
+
+         JobHandle relay = create([] {});
+         schedule(relay, dependencies + direct, count - direct);
+
+         std::array<JobHandle, JobPool::MAX_DEPENDENCIES> linked;
+         std::copy(dependencies, dependencies + direct, linked.begin());
+         linked[direct] = relay;
+
+         schedule(handle, linked.data(), linked.size());
+         return;
+      }
+
+      m_pending.fetch_add(1, std::memory_order_release);
+
+      // Hold one more release while registering, so the job cannot start
+      // before all its dependencies are registered
+      m_job_pool.setDependencies(handle.id, static_cast<uint32_t>(count + 1));
+
+      for (size_t i = 0; i < count; i++)
+      {
+         if (!m_job_pool.addContinuation(dependencies[i], handle.id, i))
+         {
+            // Already finished
+            release(handle.id);
+         }
+      }
+
+      release(handle.id);
+   }
+
+   // Schedule the job once the delay elapsed. No thread sleeps meanwhile:
+   // the job waits in a timer wheel, which threads look at when they look
+   // for work, and they park no longer than the next deadline.
+   template<typename Rep, typename Period>
+   void schedule_after(JobHandle handle, std::chrono::duration<Rep, Period> delay)
+   {
+      m_pending.fetch_add(1, std::memory_order_release);
+
+      TimerClock::time_point deadline = TimerClock::now()
+         + std::chrono::duration_cast<TimerClock::duration>(delay);
+
+      {
+         std::lock_guard<std::mutex> lock(m_timer_mutex);
+         m_timers.add(handle.id, deadline);
+         m_next_timer.store(m_timers.next().time_since_epoch().count(), std::memory_order_relaxed);
+      }
+
+      // Parked workers sleep until the previous deadline, pairs with the
+      // fence of park_worker
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      if (m_sleeping.load(std::memory_order_relaxed) > 0)
+      {
+         m_work_epoch.fetch_add(1, std::memory_order_release);
+         futexWake(m_work_epoch, 1);
+      }
+
+      // Waiting threads sleep until the previous deadline too
+      wake_waiters();
+   }
+
+   // Schedule the job on the given worker, through its mailbox: it runs
+   // there unless that worker has a backlog of mailed jobs while another
+   // thread has nothing to do. Normal jobs only, others are scheduled as
+   // usual, as are all jobs without workers or with a seed.
+   void schedule_on(JobHandle handle, size_t worker)
+   {
+      if (m_workers.empty() || m_shuffle != nullptr
+            || m_job_pool.priority(handle.id) != JobPriority::Normal)
+      {
+         schedule(handle);
+         return;
+      }
+
+      m_pending.fetch_add(1, std::memory_order_release);
+      m_workers[worker % m_workers.size()]->mailbox.enqueue(handle.id);
+
+      // Pairs with the fence of park_worker. Only the owner takes a single
+      // mailed job, so wake up all the workers.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      if (m_sleeping.load(std::memory_order_relaxed) > 0)
+      {
+         m_work_epoch.fetch_add(1, std::memory_order_release);
+         futexWake(m_work_epoch);
+      }
+
+      wake_waiters();
+   }
+
+   // Thread safe
+   bool finished(JobHandle job)
+   {
+      return m_job_pool.finished(job);
+   }
+
+   // Thread safe
+   // Cancel the job and all its descendants: the ones which did not start
+   // yet are skipped, but still finish and release their continuations. The
+   // running ones can stop early by checking is_cancelled.
+   void cancel(JobHandle job)
+   {
+      m_job_pool.cancel(job);
+   }
+
+   // Return if the job running on this thread is cancelled, see cancel
+   bool is_cancelled()
+   {
+      return t_job.system == this && m_job_pool.cancelled(t_job.id);
+   }
+
+   // Work until the given job is finished. When there is nothing to do,
+   // back off and then sleep until the job finishes.
+   void wait(JobHandle job)
+   {
+      ECS_TRACE_BEGIN("wait");
+      Backoff backoff(m_backoff);
+      WaitTimer timer(*this);
+
+      while (!m_job_pool.finished(job))
+      {
+         JobId next;
+         if (find_work(next))
+         {
+            timer.enter(Phase::Busy);
+            work_one(next);
+            backoff.reset();
+         }
+         else if (backoff.step())
+         {
+            timer.enter(Phase::Spinning);
+         }
+         else
+         {
+            timer.enter(Phase::Idle);
+            m_job_pool.park(job, park_timeout(), [this](std::atomic<uint32_t>& word) {
+               return announce_park(word);
+            });
+            end_park();
+            backoff.reset();
+         }
+      }
+
+      ECS_TRACE_END("wait");
+   }
+
+   // Work until all scheduled jobs are done, sleeping when there is nothing
+   // to do
+   void waitAll()
+   {
+      ECS_TRACE_BEGIN("wait");
+      Backoff backoff(m_backoff);
+      WaitTimer timer(*this);
+
+      while (m_pending.load(std::memory_order_acquire) > 0)
+      {
+         JobId next;
+         if (find_work(next))
+         {
+            timer.enter(Phase::Busy);
+            work_one(next);
+            backoff.reset();
+         }
+         else if (backoff.step())
+         {
+            timer.enter(Phase::Spinning);
+         }
+         else
+         {
+            timer.enter(Phase::Idle);
+            m_pending_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+            uint32_t pending = m_pending.load(std::memory_order_seq_cst);
+            if (pending > 0 && announce_park(m_pending))
+            {
+               futexWait(m_pending, pending, park_timeout());
+            }
+
+            end_park();
+
+            m_pending_waiters.fetch_sub(1, std::memory_order_relaxed);
+            backoff.reset();
+         }
+      }
+
+      ECS_TRACE_END("wait");
+   }
+
+   // Run the MainThread jobs ready so far, and return their number. Only on
+   // the thread which created the job system, for the times it does not
+   // wait on jobs.
+   size_t pump()
+   {
+      assert(on_main_thread());
+
+      size_t count = 0;
+      JobId job;
+
+      while (m_main_queue.try_dequeue(job))
+      {
+         work_one(job);
+         count++;
+      }
+
+      return count;
+   }
+
+   // Call func(first, last) on sub ranges covering [begin, end), in parallel,
+   // and return when all of them are done. A range is only split in two
+   // when the local queue is empty, a sign that other workers are idle
+   // (lazy binary splitting), and never into ranges smaller than grain.
+   template<typename F>
+   void parallel_for(size_t begin, size_t end, size_t grain, F&& func)
+   {
+      if (begin >= end)
+      {
+         return;
+      }
+
+      grain = std::max(grain, static_cast<size_t>(1));
+
+      JobHandle root = create([] {});
+      schedule_range(begin, end, grain, func, root);
+      schedule(root);
+      wait(root);
+   }
+
+   // Call func(first, last) on the ranges of grain indices covering
+   // [begin, end), one job per range, and return when all of them are done.
+   // Each range runs on the worker which ran it last time with this
+   // affinity, or which stole it, see JobAffinity. The ranges are first
+   // spread in contiguous blocks over the workers.
+   template<typename F>
+   void parallel_for(size_t begin, size_t end, size_t grain, JobAffinity& affinity, F&& func)
+   {
+      if (begin >= end)
+      {
+         return;
+      }
+
+      grain = std::max(grain, static_cast<size_t>(1));
+      size_t ranges = (end - begin + grain - 1) / grain;
+
+      if (affinity.m_workers.size() != ranges)
+      {
+         affinity.m_workers.resize(ranges);
+
+         for (size_t range = 0; range < ranges; range++)
+         {
+            affinity.m_workers[range] = range * std::max(m_workers.size(), static_cast<size_t>(1)) / ranges;
+         }
+      }
+
+      JobHandle root = create([] {});
+
+      for (size_t range = 0; range < ranges; range++)
+      {
+         size_t first = begin + range * grain;
+         size_t last = std::min(first + grain, end);
+
+         JobHandle job = create([this, first, last, range, &affinity, &func] {
+            // Ranges run by other threads keep their worker
+            if (current_worker() != nullptr)
+            {
+               affinity.m_workers[range] = t_worker.index;
+            }
+
+            func(first, last);
+         }, root);
+
+         schedule_on(job, affinity.m_workers[range]);
+      }
+
+      schedule(root);
+      wait(root);
+   }
+
+   size_t workerCount() const
+   {
+      return m_workers.size();
+   }
+
+   // NUMA node of the CPUs given to a worker, as an index in topology().nodes
+   size_t workerNode(size_t worker) const
+   {
+      return m_workers[worker]->node;
+   }
+
+   const CpuTopology& topology() const
+   {
+      return m_topology;
+   }
+
+   // Number of jobs allocated by the pool, it grows with the number of jobs
+   // alive at the same time
+   size_t jobCapacity() const
+   {
+      return m_job_pool.capacity();
+   }
+
+   // Thread safe, read while the workers run. Counters restart with resize.
+   JobSystemStats stats() const
+   {
+      JobSystemStats result;
+
+      for (const std::unique_ptr<Worker>& worker : m_workers)
+      {
+         result.workers.push_back(worker->counters.snapshot());
+         worker->timer.addCurrent(result.workers.back());
+      }
+
+      result.external = m_external_counters.snapshot();
+      result.poolExhausted = m_pool_exhausted.load(std::memory_order_relaxed);
+
+      return result;
+   }
+
+private:
+   // What a thread running jobs spends its time on
+   enum class Phase
+   {
+      Outside,
+      Busy,
+      Spinning,
+      Idle
+   };
+
+   // Written by their threads with relaxed atomics, alone on their cache
+   // lines so that reading them does not slow the workers down
+   struct alignas(64) Counters
+   {
+      std::atomic<uint64_t> executed{0};
+      std::atomic<uint64_t> stolen{0};
+      std::atomic<uint64_t> busyTime{0};
+      std::atomic<uint64_t> spinTime{0};
+      std::atomic<uint64_t> idleTime{0};
+      std::atomic<uint64_t> queueHighWater{0};
+
+      void add(std::atomic<uint64_t>& counter, uint64_t value)
+      {
+         counter.fetch_add(value, std::memory_order_relaxed);
+      }
+
+      WorkerStats snapshot() const
+      {
+         WorkerStats stats;
+         stats.executed = executed.load(std::memory_order_relaxed);
+         stats.stolen = stolen.load(std::memory_order_relaxed);
+         stats.busyTime = busyTime.load(std::memory_order_relaxed);
+         stats.spinTime = spinTime.load(std::memory_order_relaxed);
+         stats.idleTime = idleTime.load(std::memory_order_relaxed);
+         stats.queueHighWater = queueHighWater.load(std::memory_order_relaxed);
+         return stats;
+      }
+   };
+
+   // Accumulate the time spent in each phase, reading the clock only when
+   // the phase changes. The current phase is published for stats.
+   class PhaseTimer
+   {
+   public:
+      explicit PhaseTimer(Counters& counters)
+         : m_counters(counters), m_phase(Phase::Outside), m_published_phase(Phase::Outside)
+      {
+      }
+
+      Phase phase() const
+      {
+         return m_phase;
+      }
+
+      void enter(Phase phase)
+      {
+         if (phase == m_phase)
+         {
+            return;
+         }
+
+         std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+         uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_start).count());
+
+         switch (m_phase)
+         {
+         case Phase::Busy:
+            m_counters.add(m_counters.busyTime, elapsed);
+            break;
+         case Phase::Spinning:
+            m_counters.add(m_counters.spinTime, elapsed);
+            break;
+         case Phase::Idle:
+            m_counters.add(m_counters.idleTime, elapsed);
+            break;
+         case Phase::Outside:
+            break;
+         }
+
+         m_phase = phase;
+         m_start = now;
+
+         m_published_start.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+         m_published_phase.store(phase, std::memory_order_relaxed);
+      }
+
+      // Thread safe, add the time spent so far in the current phase
+      void addCurrent(WorkerStats& stats) const
+      {
+         std::chrono::steady_clock::duration start(m_published_start.load(std::memory_order_relaxed));
+         std::chrono::steady_clock::duration now = std::chrono::steady_clock::now().time_since_epoch();
+         uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+
+         switch (m_published_phase.load(std::memory_order_relaxed))
+         {
+         case Phase::Busy:
+            stats.busyTime += elapsed;
+            break;
+         case Phase::Spinning:
+            stats.spinTime += elapsed;
+            break;
+         case Phase::Idle:
+            stats.idleTime += elapsed;
+            break;
+         case Phase::Outside:
+            break;
+         }
+      }
+
+   private:
+      Counters& m_counters;
+      Phase m_phase;
+      std::chrono::steady_clock::time_point m_start;
+
+      std::atomic<Phase> m_published_phase;
+      std::atomic<std::chrono::steady_clock::rep> m_published_start{0};
+   };
+
+   // Timer of wait and waitAll: the one of the worker, back to its phase at
+   // the end, or one for the external counters
+   class WaitTimer
+   {
+   public:
+      explicit WaitTimer(JobSystem& system)
+         : m_external(system.m_external_counters), m_timer(system.local_timer(m_external)),
+           m_resume(m_timer.phase())
+      {
+      }
+
+      ~WaitTimer()
+      {
+         m_timer.enter(m_resume);
+      }
+
+      void enter(Phase phase)
+      {
+         m_timer.enter(phase);
+      }
+
+   private:
+      PhaseTimer m_external;
+      PhaseTimer& m_timer;
+      Phase m_resume;
+   };
+
+   struct Worker
+   {
+      // Jobs made ready by this worker, one deque per priority. It pops the
+      // newest ones while the others steal the oldest ones.
+      std::array<WorkStealingDeque<JobId>, PRIORITY_LEVELS> deques{
+         WorkStealingDeque<JobId>(DEQUE_CAPACITY),
+         WorkStealingDeque<JobId>(DEQUE_CAPACITY),
+         WorkStealingDeque<JobId>(DEQUE_CAPACITY)
+      };
+      std::thread thread;
+
+      // Free jobs of this worker
+      JobPool::Cache cache;
+
+      Counters counters;
+      PhaseTimer timer{counters};
+
+      // Placement of this worker, see AffinityPolicy
+      size_t node = 0;
+      int cpu = -1;
+
+      // Workers to steal from, in order
+      std::vector<size_t> steal_order;
+
+      // Normal jobs scheduled on this worker, see schedule_on
+      moodycamel::ConcurrentQueue<JobId> mailbox;
+
+      // Word this worker sleeps on while it waits on jobs inside a job, to
+      // wake it when one is pushed, see announce_park
+      std::atomic<std::atomic<uint32_t>*> park_word{nullptr};
+   };
+
+   // The worker running on the current thread, if any
+   struct WorkerContext
+   {
+      JobSystem* system;
+      size_t index;
+   };
+
+   static constexpr size_t DEQUE_CAPACITY = 4096;
+
+   static inline thread_local WorkerContext t_worker{nullptr, 0};
+
+   // The job running on the current thread, for is_cancelled
+   struct JobContext
+   {
+      JobSystem* system;
+      JobId id;
+   };
+
+   static inline thread_local JobContext t_job{nullptr, 0};
+
+   // Ready jobs drawn in a seeded random order, see JobSystemConfig::seed
+   struct Shuffle
+   {
+      std::mutex mutex;
+      std::mt19937_64 random;
+      std::vector<JobId> ready;
+   };
+
+   // Jobs scheduled from outside the workers, and overflow of full deques,
+   // per priority
+   std::array<moodycamel::ConcurrentQueue<JobId>, PRIORITY_LEVELS> m_injection_queues;
+
+   // MainThread jobs, and the word the main thread sleeps on while it waits
+   // on jobs, to wake it when one is pushed. Without workers, any job pushed
+   // from another thread wakes it.
+   moodycamel::ConcurrentQueue<JobId> m_main_queue;
+   std::atomic<std::atomic<uint32_t>*> m_main_park_word{nullptr};
+   const std::thread::id m_main_thread = std::this_thread::get_id();
+
+   // LongRunning jobs, and the number of workers running one of them
+   moodycamel::ConcurrentQueue<JobId> m_long_running_queue;
+   std::atomic<size_t> m_long_running;
+   const size_t m_long_running_workers;
+   size_t m_long_running_limit;
+
+   // Number of scheduled jobs not finished yet, waitAll parks on it
+   std::atomic<uint32_t> m_pending;
+   std::atomic<uint32_t> m_pending_waiters;
+
+   std::atomic<bool> m_running;
+
+   // Number of parked workers, and the word they park on. Pushing a job
+   // changes the word to wake one of them.
+   std::atomic<uint32_t> m_sleeping;
+   std::atomic<uint32_t> m_work_epoch;
+
+   // Number of workers sleeping in wait or waitAll inside a job, on their
+   // Worker::park_word
+   std::atomic<uint32_t> m_parked_waiters{0};
+
+   const ExecutionMode m_mode;
+   std::unique_ptr<Shuffle> m_shuffle;
+
+   const BackoffPolicy m_backoff;
+   const AffinityPolicy m_affinity;
+   const CpuTopology m_topology;
+
+   std::vector<std::unique_ptr<Worker>> m_workers;
+
+   // Jobs scheduled after a delay, and a copy of their next deadline to check
+   // without locking
+   using TimerClock = TimerWheel<JobId>::Clock;
+   static constexpr TimerClock::rep NO_TIMER = TimerClock::time_point::max().time_since_epoch().count();
+
+   std::mutex m_timer_mutex;
+   TimerWheel<JobId> m_timers;
+   std::atomic<TimerClock::rep> m_next_timer{NO_TIMER};
+
+   // Counters of the threads waiting on jobs, which are not workers
+   Counters m_external_counters;
+   std::atomic<uint64_t> m_pool_exhausted{0};
+
+   JobPool m_job_pool;
+
+   static size_t workerCountOf(const JobSystemConfig& config)
+   {
+      switch (config.mode)
+      {
+      case ExecutionMode::Inline:
+         return 0;
+      case ExecutionMode::SingleWorker:
+         return 1;
+      default:
+         // By default, one worker per hardware thread minus the calling
+         // thread, and at least one worker. hardware_concurrency may be 0
+         // when unknown.
+         return config.workerCount > 0 ? config.workerCount
+            : std::max(2u, std::thread::hardware_concurrency()) - 1;
+      }
+   }
+
+   void start_workers(size_t thread_count)
+   {
+      assert(m_workers.empty());
+
+      m_running.store(true, std::memory_order_relaxed);
+      m_workers.reserve(thread_count);
+
+      m_long_running_limit = m_long_running_workers > 0 ? m_long_running_workers
+         : std::max(thread_count, static_cast<size_t>(2)) - 1;
+
+      // Spread the workers over the CPUs, node after node
+      std::vector<std::pair<size_t, int>> cpus;
+      for (size_t node = 0; node < m_topology.nodes.size(); node++)
+      {
+         for (int cpu : m_topology.nodes[node])
+         {
+            cpus.emplace_back(node, cpu);
+         }
+      }
+
+      for (size_t i = 0; i < thread_count; i++)
+      {
+         m_workers.emplace_back(new Worker());
+
+         if (!cpus.empty())
+         {
+            m_workers[i]->node = cpus[i % cpus.size()].first;
+            m_workers[i]->cpu = cpus[i % cpus.size()].second;
+         }
+      }
+
+      for (size_t i = 0; i < thread_count; i++)
+      {
+         m_workers[i]->steal_order = steal_order(i);
+      }
+
+      // Start the threads once all deques exist, as they steal from each other
+      for (size_t i = 0; i < thread_count; i++)
+      {
+         m_workers[i]->thread = std::thread([this, i] {
+            t_worker = {this, i};
+            ECS_TRACE_THREAD_NAME("worker " + std::to_string(i));
+
+            Worker& worker = *m_workers[i];
+
+            if (m_affinity.pinWorkers && worker.cpu >= 0)
+            {
+               setCurrentThreadAffinity({worker.cpu});
+            }
+            else if (m_affinity.numaAware && worker.cpu >= 0)
+            {
+               setCurrentThreadAffinity(m_topology.nodes[worker.node]);
+            }
+
+            Backoff backoff(m_backoff);
+            JobId job;
+
+            while (m_running.load(std::memory_order_relaxed))
+            {
+               if (find_work(job))
+               {
+                  worker.timer.enter(Phase::Busy);
+                  work_one(job);
+                  backoff.reset();
+               }
+               else if (backoff.step())
+               {
+                  worker.timer.enter(Phase::Spinning);
+               }
+               else
+               {
+                  park_worker();
+                  backoff.reset();
+               }
+            }
+
+            worker.timer.enter(Phase::Outside);
+         });
+      }
+   }
+
+   // The other workers, following the first one, with the workers of the
+   // same node first when NUMA aware
+   std::vector<size_t> steal_order(size_t index)
+   {
+      std::vector<size_t> order;
+      size_t count = m_workers.size();
+
+      for (size_t i = 1; i < count; i++)
+      {
+         order.push_back((index + i) % count);
+      }
+
+      if (m_affinity.numaAware)
+      {
+         size_t node = m_workers[index]->node;
+         std::stable_partition(order.begin(), order.end(), [this, node](size_t victim) {
+            return m_workers[victim]->node == node;
+         });
+      }
+
+      return order;
+   }
+
+   // Workers poll the deques of each other, they must all stop before those
+   // are destroyed
+   void stop_workers()
+   {
+      assert(current_worker() == nullptr);
+
+      m_running.store(false, std::memory_order_relaxed);
+
+      m_work_epoch.fetch_add(1, std::memory_order_seq_cst);
+      futexWake(m_work_epoch);
+
+      for (std::unique_ptr<Worker>& worker : m_workers)
+      {
+         worker->thread.join();
+         m_job_pool.flush(worker->cache);
+      }
+
+      m_workers.clear();
+   }
+
+   // Return the worker running on this thread, or nullptr for other threads
+   Worker* current_worker()
+   {
+      return t_worker.system == this ? m_workers[t_worker.index].get() : nullptr;
+   }
+
+   // Counters of this thread, shared by the threads which are not workers
+   Counters& local_counters()
+   {
+      Worker* worker = current_worker();
+      return worker != nullptr ? worker->counters : m_external_counters;
+   }
+
+   // Timer of the worker running on this thread, or the given one
+   PhaseTimer& local_timer(PhaseTimer& external)
+   {
+      Worker* worker = current_worker();
+      return worker != nullptr ? worker->timer : external;
+   }
+
+   // Free jobs of the worker running on this thread, if any
+   JobPool::Cache* local_cache()
+   {
+      Worker* worker = current_worker();
+      return worker != nullptr ? &worker->cache : nullptr;
+   }
+
+   bool on_main_thread() const
+   {
+      return std::this_thread::get_id() == m_main_thread;
+   }
+
+   // Before the main thread sleeps on the given word, publish it so that
+   // pushing a MainThread job, or any job without workers, wakes it up.
+   // Workers waiting inside a job publish theirs too, to be woken by any
+   // job. Return false if one is queued.
+   bool announce_park(std::atomic<uint32_t>& word)
+   {
+      Worker* worker = current_worker();
+      if (worker != nullptr)
+      {
+         worker->park_word.store(&word, std::memory_order_relaxed);
+         m_parked_waiters.fetch_add(1, std::memory_order_relaxed);
+
+         // Pairs with the fence of push_ready
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+
+         return !has_ready_jobs(worker);
+      }
+
+      if (!on_main_thread())
+      {
+         return true;
+      }
+
+      m_main_park_word.store(&word, std::memory_order_relaxed);
+
+      // Pairs with the fence of push_ready
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      if (m_main_queue.size_approx() > 0)
+      {
+         return false;
+      }
+
+      return !m_workers.empty() || !has_ready_jobs(nullptr);
+   }
+
+   // Return if a job the given worker, or a thread without workers, can
+   // take is queued. LongRunning jobs are left to their lanes.
+   bool has_ready_jobs(Worker* worker)
+   {
+      for (size_t level = 0; level < PRIORITY_LEVELS; level++)
+      {
+         if (m_injection_queues[level].size_approx() > 0)
+         {
+            return true;
+         }
+      }
+
+      for (const std::unique_ptr<Worker>& other : m_workers)
+      {
+         for (size_t level = 0; level < PRIORITY_LEVELS; level++)
+         {
+            if (!other->deques[level].empty())
+            {
+               return true;
+            }
+         }
+
+         // Only the backlog of another mailbox can be stolen
+         if (other->mailbox.size_approx() > (other.get() == worker ? 0 : 1))
+         {
+            return true;
+         }
+      }
+
+      if (m_workers.empty() && m_long_running_queue.size_approx() > 0)
+      {
+         return true;
+      }
+
+      if (m_shuffle != nullptr)
+      {
+         std::lock_guard<std::mutex> lock(m_shuffle->mutex);
+         return !m_shuffle->ready.empty();
+      }
+
+      return false;
+   }
+
+   void wake_main_thread()
+   {
+      std::atomic<uint32_t>* word = m_main_park_word.load(std::memory_order_relaxed);
+      if (word != nullptr)
+      {
+         futexWake(*word);
+      }
+   }
+
+   // After a push, wake the threads sleeping in wait or waitAll, which
+   // otherwise only wake when what they wait on finishes: the main thread
+   // without workers, else the workers waiting inside a job
+   void wake_waiters()
+   {
+      if (m_workers.empty())
+      {
+         wake_main_thread();
+         return;
+      }
+
+      if (m_parked_waiters.load(std::memory_order_relaxed) == 0)
+      {
+         return;
+      }
+
+      for (const std::unique_ptr<Worker>& worker : m_workers)
+      {
+         std::atomic<uint32_t>* word = worker->park_word.load(std::memory_order_relaxed);
+         if (word != nullptr)
+         {
+            futexWake(*word);
+         }
+      }
+   }
+
+   void end_park()
+   {
+      Worker* worker = current_worker();
+      if (worker != nullptr)
+      {
+         if (worker->park_word.exchange(nullptr, std::memory_order_relaxed) != nullptr)
+         {
+            m_parked_waiters.fetch_sub(1, std::memory_order_relaxed);
+         }
+      }
+      else if (on_main_thread())
+      {
+         m_main_park_word.store(nullptr, std::memory_order_relaxed);
+      }
+   }
+
+   void push_ready(JobId job)
+   {
+      JobPriority priority = m_job_pool.priority(job);
+
+      if (priority == JobPriority::MainThread)
+      {
+         m_main_queue.enqueue(job);
+
+         // Either the main thread sees the job before sleeping, or this sees
+         // the word it sleeps on
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         wake_main_thread();
+
+         return;
+      }
+
+      if (priority == JobPriority::LongRunning)
+      {
+         m_long_running_queue.enqueue(job);
+      }
+      else if (m_shuffle != nullptr)
+      {
+         std::lock_guard<std::mutex> lock(m_shuffle->mutex);
+         m_shuffle->ready.push_back(job);
+      }
+      else
+      {
+         size_t level = static_cast<size_t>(priority);
+         Worker* worker = current_worker();
+
+         if (worker == nullptr || !worker->deques[level].push(job))
+         {
+            m_injection_queues[level].enqueue(job);
+         }
+         else
+         {
+            uint64_t depth = worker->deques[level].size();
+            if (depth > worker->counters.queueHighWater.load(std::memory_order_relaxed))
+            {
+               worker->counters.queueHighWater.store(depth, std::memory_order_relaxed);
+            }
+         }
+      }
+
+      // Pairs with the fence of park_worker: either the worker sees the job,
+      // or this sees the worker sleeping
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      if (m_sleeping.load(std::memory_order_relaxed) > 0)
+      {
+         m_work_epoch.fetch_add(1, std::memory_order_release);
+         futexWake(m_work_epoch, 1);
+      }
+
+      wake_waiters();
+   }
+
+   // Sleep until a job is pushed, or the park timeout or the next timer
+   // expires
+   void park_worker()
+   {
+      uint32_t epoch = m_work_epoch.load(std::memory_order_acquire);
+
+      m_sleeping.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      // Look again now that pushes will wake this worker
+      Worker& worker = *current_worker();
+      JobId job;
+      if (find_work(job))
+      {
+         m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+         worker.timer.enter(Phase::Busy);
+         work_one(job);
+         return;
+      }
+
+      if (m_running.load(std::memory_order_relaxed))
+      {
+         worker.timer.enter(Phase::Idle);
+         ECS_TRACE_BEGIN("idle");
+         futexWait(m_work_epoch, epoch, park_timeout());
+         ECS_TRACE_END("idle");
+      }
+
+      m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+   }
+
+   // Look for a job, from the highest priority to the lowest: newest local
+   // one first, then external ones, then the oldest one of another worker.
+   // LongRunning jobs come last. Delayed jobs which are due are pushed first,
+   // so that they do not wait for the queues to drain.
+   bool find_work(JobId& job)
+   {
+      expire_timers();
+
+      Worker* worker = current_worker();
+
+      if (worker == nullptr && on_main_thread() && m_main_queue.try_dequeue(job))
+      {
+         return true;
+      }
+
+      if (m_mode == ExecutionMode::SingleWorker && worker == nullptr)
+      {
+         return false;
+      }
+
+      if (m_shuffle != nullptr && take_shuffled(job))
+      {
+         return true;
+      }
+
+      for (size_t level = 0; level < PRIORITY_LEVELS; level++)
+      {
+         if (worker != nullptr && level == static_cast<size_t>(JobPriority::Normal)
+               && worker->mailbox.try_dequeue(job))
+         {
+            return true;
+         }
+
+         if (worker != nullptr && worker->deques[level].pop(job))
+         {
+            return true;
+         }
+
+         if (m_injection_queues[level].try_dequeue(job))
+         {
+            return true;
+         }
+
+         if (steal(job, level))
+         {
+            return true;
+         }
+      }
+
+      if (steal_mailed(job))
+      {
+         return true;
+      }
+
+      // Threads waiting on jobs only take LongRunning ones when there is no
+      // worker to run them
+      if ((worker != nullptr || m_workers.empty()) && take_long_running(job))
+      {
+         return true;
+      }
+
+      return false;
+   }
+
+   // Push the jobs of the timer wheel which are due, and return if there
+   // were any. Another thread expiring them is enough. Cheap until the next
+   // deadline: a relaxed load, and the clock once there is a timer.
+   bool expire_timers()
+   {
+      TimerClock::rep next = m_next_timer.load(std::memory_order_relaxed);
+      if (next == NO_TIMER)
+      {
+         return false;
+      }
+
+      TimerClock::time_point now = TimerClock::now();
+      if (now.time_since_epoch().count() < next)
+      {
+         return false;
+      }
+
+      std::unique_lock<std::mutex> lock(m_timer_mutex, std::try_to_lock);
+      if (!lock.owns_lock())
+      {
+         return false;
+      }
+
+      size_t count = m_timers.expire(now, [this](JobId job) {
+         push_ready(job);
+      });
+
+      m_next_timer.store(m_timers.next().time_since_epoch().count(), std::memory_order_relaxed);
+
+      if (count > 0)
+      {
+         ECS_TRACE_INSTANT("timer");
+      }
+
+      return count > 0;
+   }
+
+   // Park timeout, cut short to expire the next timer
+   std::chrono::microseconds park_timeout() const
+   {
+      TimerClock::rep next = m_next_timer.load(std::memory_order_relaxed);
+      if (next == NO_TIMER)
+      {
+         return m_backoff.parkTimeout;
+      }
+
+      TimerClock::duration left = TimerClock::duration(next) - TimerClock::now().time_since_epoch();
+      return std::clamp(std::chrono::ceil<std::chrono::microseconds>(left),
+         std::chrono::microseconds(0), m_backoff.parkTimeout);
+   }
+
+   bool steal(JobId& job, size_t level)
+   {
+      Worker* worker = current_worker();
+
+      if (worker != nullptr)
+      {
+         for (size_t victim : worker->steal_order)
+         {
+            if (m_workers[victim]->deques[level].steal(job))
+            {
+               ECS_TRACE_INSTANT("steal");
+               worker->counters.add(worker->counters.stolen, 1);
+               return true;
+            }
+         }
+
+         return false;
+      }
+
+      for (std::unique_ptr<Worker>& victim : m_workers)
+      {
+         if (victim->deques[level].steal(job))
+         {
+            ECS_TRACE_INSTANT("steal");
+            m_external_counters.add(m_external_counters.stolen, 1);
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   // Take a job mailed to another worker, only from a mailbox holding more
+   // than one job: the owner is behind while this thread has nothing to do
+   bool steal_mailed(JobId& job)
+   {
+      Worker* worker = current_worker();
+
+      for (std::unique_ptr<Worker>& victim : m_workers)
+      {
+         if (victim.get() != worker && victim->mailbox.size_approx() > 1 && victim->mailbox.try_dequeue(job))
+         {
+            ECS_TRACE_INSTANT("steal");
+            Counters& counters = local_counters();
+            counters.add(counters.stolen, 1);
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   // Take a random ready job, see JobSystemConfig::seed
+   bool take_shuffled(JobId& job)
+   {
+      std::lock_guard<std::mutex> lock(m_shuffle->mutex);
+      std::vector<JobId>& ready = m_shuffle->ready;
+
+      if (ready.empty())
+      {
+         return false;
+      }
+
+      size_t index = m_shuffle->random() % ready.size();
+      job = ready[index];
+      ready[index] = ready.back();
+      ready.pop_back();
+
+      return true;
+   }
+
+   // Take a LongRunning job if less than m_long_running_limit are running.
+   // work_one gives the slot back once the job is done.
+   bool take_long_running(JobId& job)
+   {
+      size_t running = m_long_running.load(std::memory_order_relaxed);
+
+      do
+      {
+         if (running >= m_long_running_limit)
+         {
+            return false;
+         }
+      }
+      while (!m_long_running.compare_exchange_weak(running, running + 1, std::memory_order_acquire));
+
+      if (!m_long_running_queue.try_dequeue(job))
+      {
+         m_long_running.fetch_sub(1, std::memory_order_release);
+         return false;
+      }
+
+      return true;
+   }
+
+   template<typename F>
+   void schedule_range(size_t begin, size_t end, size_t grain, F& func, JobHandle root)
+   {
+      schedule(create([this, begin, end, grain, &func, root] {
+         run_range(begin, end, grain, func, root);
+      }, root));
+   }
+
+   template<typename F>
+   void run_range(size_t begin, size_t end, size_t grain, F& func, JobHandle root)
+   {
+      while (end - begin > grain)
+      {
+         if (local_queue_empty())
+         {
+            // Give away the second half, idle workers will steal it
+            size_t middle = begin + (end - begin) / 2;
+            schedule_range(middle, end, grain, func, root);
+            end = middle;
+         }
+         else
+         {
+            func(begin, begin + grain);
+            begin += grain;
+         }
+      }
+
+      func(begin, end);
+   }
+
+   // Return if the Normal queue this thread pushes to is empty
+   bool local_queue_empty()
+   {
+      size_t level = static_cast<size_t>(JobPriority::Normal);
+      Worker* worker = current_worker();
+      return worker != nullptr ? worker->deques[level].empty() : m_injection_queues[level].size_approx() == 0;
+   }
+
+   // Schedule the job once release_external is called on it, by a thread
+   // completing an event outside of the job system, such as an I/O
+   void schedule_external(JobHandle handle)
+   {
+      m_pending.fetch_add(1, std::memory_order_release);
+      m_job_pool.setDependencies(handle.id, 1);
+   }
+
+   void release_external(JobHandle handle)
+   {
+      release(handle.id);
+   }
+
+   // Release one dependency of the given job, pushing it when it is ready
+   void release(JobId job)
+   {
+      if (m_job_pool.releaseDependency(job))
+      {
+         push_ready(job);
+      }
+   }
+
+   void try_work()
+   {
+      JobId job;
+      if (find_work(job))
+      {
+         work_one(job);
+      }
+      else
+      {
+         std::this_thread::yield();
+      }
+   }
+
+   void work_one(JobId job)
+   {
+      // Read before the job is released and reused
+      bool longRunning = m_job_pool.priority(job) == JobPriority::LongRunning;
+#ifdef ECS_JOB_TRACING
+      const char* name = m_job_pool.name(job);
+#endif
+
+      ECS_TRACE_BEGIN(name);
+
+      // Jobs waiting on other jobs run them on the same thread
+      JobContext outer = t_job;
+      t_job = {this, job};
+
+      // Ready continuations go straight to the local queue
+      m_job_pool.invoke(job, [this](JobId continuation) {
+         push_ready(continuation);
+      }, local_cache());
+
+      t_job = outer;
+
+      ECS_TRACE_END(name);
+
+      Counters& counters = local_counters();
+      counters.add(counters.executed, 1);
+
+      if (longRunning)
+      {
+         m_long_running.fetch_sub(1, std::memory_order_release);
+      }
+
+      if (m_pending.fetch_sub(1, std::memory_order_seq_cst) == 1
+            && m_pending_waiters.load(std::memory_order_seq_cst) > 0)
+      {
+         futexWake(m_pending);
+      }
+   }
+};
+
+// A job graph built once and launched many times, such as the jobs of a
+// frame. Its jobs keep their pool slots and tasks between launches, so a
+// launch only resets a few counters per job and pushes the jobs without
+// dependencies.
+class JobGraph
+{
+public:
+   // Index of a job in the graph
+   using Node = size_t;
+
+   explicit JobGraph(JobSystem& system) : m_system(system), m_launched(false)
+   {
+      // The completion of the graph, parent of the jobs without one
+      m_nodes.push_back({m_system.create([] {}), 0, 0, std::nullopt});
+      m_system.m_job_pool.setPersistent(m_nodes[0].handle.id);
+   }
+
+   // Wait for the last launch, and give the jobs back to the pool
+   ~JobGraph()
+   {
+      if (m_launched)
+      {
+         m_system.wait(m_nodes[0].handle);
+      }
+
+      for (NodeInfo& node : m_nodes)
+      {
+         m_system.m_job_pool.releasePersistent(node.handle.id);
+      }
+   }
+
+   JobGraph(const JobGraph&) = delete;
+   JobGraph& operator=(const JobGraph&) = delete;
+
+   // Not thread safe, as all the building methods
+   template<typename F>
+   Node add(F&& task, JobPriority priority = JobPriority::Normal)
+   {
+      return add(std::forward<F>(task), 0, priority);
+   }
+
+   // The parent is finished when the job and all its children are
+   template<typename F>
+   Node add(F&& task, Node parent, JobPriority priority = JobPriority::Normal)
+   {
+      assert(parent < m_nodes.size());
+
+      JobHandle handle = m_system.create(std::forward<F>(task), m_nodes[parent].handle, priority);
+      m_system.m_job_pool.setPersistent(handle.id);
+
+      m_nodes[parent].children++;
+      m_nodes.push_back({handle, 0, 0, std::nullopt});
+
+      return m_nodes.size() - 1;
+   }
+
+   // The node only runs once the dependency is finished, at each launch
+   void addDependency(Node node, Node dependency)
+   {
+      assert(node < m_nodes.size() && dependency < m_nodes.size());
+
+      // The last link of a node goes to an empty relay job, which takes the
+      // following dependencies
+      while (m_nodes[node].relay.has_value() || m_nodes[node].dependencies == JobPool::MAX_DEPENDENCIES - 1)
+      {
+         if (!m_nodes[node].relay.has_value())
+         {
+            Node relay = add([] {});
+            link(node, relay);
+            m_nodes[node].relay = relay;
+         }
+
+         node = m_nodes[node].relay.value();
+      }
+
+      link(node, dependency);
+   }
+
+   // Run all the jobs of the graph, once the previous launch is finished.
+   // Return the handle finished with all of them.
+   JobHandle launch()
+   {
+      if (m_launched)
+      {
+         m_system.wait(m_nodes[0].handle);
+      }
+
+      m_launched = true;
+
+      // Reset everything before pushing any job, as they release each other
+      for (NodeInfo& node : m_nodes)
+      {
+         node.handle = m_system.m_job_pool.reopen(node.handle.id, node.dependencies, 1 + node.children);
+      }
+
+      m_system.m_pending.fetch_add(static_cast<uint32_t>(m_nodes.size()), std::memory_order_release);
+
+      for (NodeInfo& node : m_nodes)
+      {
+         if (node.dependencies == 0)
+         {
+            m_system.push_ready(node.handle.id);
+         }
+      }
+
+      return m_nodes[0].handle;
+   }
+
+   // Handle of the job of the given node for the last launch
+   JobHandle handle(Node node) const
+   {
+      return m_nodes[node].handle;
+   }
+
+   // Number of jobs, relays and completion included
+   size_t size() const
+   {
+      return m_nodes.size();
+   }
+
+private:
+   struct NodeInfo
+   {
+      JobHandle handle;
+      size_t children;
+
+      // Number of dependency links used
+      uint32_t dependencies;
+      std::optional<Node> relay;
+   };
+
+   JobSystem& m_system;
+   std::vector<NodeInfo> m_nodes;
+   bool m_launched;
+
+   void link(Node node, Node dependency)
+   {
+      m_system.m_job_pool.addStaticContinuation(m_nodes[dependency].handle.id, m_nodes[node].handle.id,
+            m_nodes[node].dependencies);
+      m_nodes[node].dependencies++;
    }
 };
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Job execution tracing, only recorded when ECS_JOB_TRACING is defined.
+// Otherwise the ECS_TRACE macros expand to nothing.
+//
+// Each thread records its events in its own ring buffer, without locks, and
+// the oldest events are overwritten once it is full. Once its events were
+// dumped or cleared, the buffer of a thread which exited is reused by the
+// next new thread, so restarting workers does not grow the trace, and the
+// events of a thread never show under the name of another. Dump the trace
+// while no job runs, for instance after JobSystem::waitAll, and open it in
+// chrome://tracing or Perfetto.
+
+#ifdef ECS_JOB_TRACING
+#define ECS_TRACE_BEGIN(name) JobTrace::instance().record(JobTrace::Phase::Begin, name)
+#define ECS_TRACE_END(name) JobTrace::instance().record(JobTrace::Phase::End, name)
+#define ECS_TRACE_INSTANT(name) JobTrace::instance().record(JobTrace::Phase::Instant, name)
+#define ECS_TRACE_THREAD_NAME(name) JobTrace::instance().setThreadName(name)
+#else
+#define ECS_TRACE_BEGIN(name) ((void) 0)
+#define ECS_TRACE_END(name) ((void) 0)
+#define ECS_TRACE_INSTANT(name) ((void) 0)
+#define ECS_TRACE_THREAD_NAME(name) ((void) 0)
+#endif
+
+class JobTrace
+{
+public:
+   enum class Phase : uint8_t
+   {
+      Begin,
+      End,
+      Instant
+   };
+
+   // Number of events kept per thread
+   static constexpr size_t CAPACITY = 65536;
+
+   static JobTrace& instance()
+   {
+      static JobTrace trace;
+      return trace;
+   }
+
+   // Record an event of the calling thread. The name must outlive the
+   // trace, such as a string literal.
+   void record(Phase phase, const char* name)
+   {
+      Buffer& buffer = localBuffer();
+      uint64_t count = buffer.count.load(std::memory_order_relaxed);
+
+      Event& event = buffer.events[count % CAPACITY];
+      event.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_start).count();
+      event.name = name;
+      event.phase = phase;
+
+      // Publish the event to the dump
+      buffer.count.store(count + 1, std::memory_order_release);
+   }
+
+   // Name the calling thread in the trace
+   void setThreadName(const std::string& name)
+   {
+      Buffer& buffer = localBuffer();
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      buffer.name = name;
+   }
+
+   // Write the events of all threads as Chrome trace JSON
+   void writeChromeTrace(std::ostream& out)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      out << "{\"traceEvents\":[";
+      bool first = true;
+
+      for (size_t tid = 0; tid < m_buffers.size(); tid++)
+      {
+         Buffer& buffer = *m_buffers[tid];
+
+         writeSeparator(out, first);
+         out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+             << ",\"args\":{\"name\":";
+         writeString(out, buffer.name.c_str());
+         out << "}}";
+
+         uint64_t count = buffer.count.load(std::memory_order_acquire);
+         uint64_t begin = count > CAPACITY ? count - CAPACITY : 0;
+         buffer.reusable = buffer.retired;
+
+         for (uint64_t i = begin; i < count; i++)
+         {
+            const Event& event = buffer.events[i % CAPACITY];
+
+            writeSeparator(out, first);
+            out << "{\"name\":";
+            writeString(out, event.name);
+            out << ",\"ph\":\"" << phaseCode(event.phase)
+                << "\",\"ts\":" << event.time / 1000 << "." << event.time % 1000 / 100
+                << ",\"pid\":1,\"tid\":" << tid;
+
+            if (event.phase == Phase::Instant)
+            {
+               out << ",\"s\":\"t\"";
+            }
+
+            out << "}";
+         }
+      }
+
+      out << "]}\n";
+   }
+
+   // Drop the recorded events, while no thread records any
+   void clear()
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      for (std::unique_ptr<Buffer>& buffer : m_buffers)
+      {
+         buffer->count.store(0, std::memory_order_relaxed);
+         buffer->reusable = buffer->retired;
+      }
+   }
+
+private:
+   struct Event
+   {
+      // Nanoseconds since the trace started
+      int64_t time;
+      const char* name;
+      Phase phase;
+   };
+
+   struct Buffer
+   {
+      std::vector<Event> events = std::vector<Event>(CAPACITY);
+      std::atomic<uint64_t> count{0};
+      std::string name;
+
+      // The thread recording in it exited, and then its events were dumped
+      // or cleared, so that a new thread can take it over
+      bool retired = false;
+      bool reusable = false;
+   };
+
+   // Give the buffer of a thread back when it exits
+   struct LocalBuffer
+   {
+      Buffer* buffer = nullptr;
+
+      ~LocalBuffer()
+      {
+         if (buffer != nullptr)
+         {
+            JobTrace::instance().retire(*buffer);
+         }
+      }
+   };
+
+   JobTrace() : m_start(std::chrono::steady_clock::now())
+   {
+   }
+
+   // Buffers are owned by the trace, so that the events of stopped threads
+   // can still be dumped
+   Buffer& localBuffer()
+   {
+      static thread_local LocalBuffer t_buffer;
+
+      if (t_buffer.buffer == nullptr)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+
+         for (size_t tid = 0; tid < m_buffers.size() && t_buffer.buffer == nullptr; tid++)
+         {
+            if (m_buffers[tid]->reusable)
+            {
+               t_buffer.buffer = m_buffers[tid].get();
+               t_buffer.buffer->count.store(0, std::memory_order_relaxed);
+               t_buffer.buffer->retired = false;
+               t_buffer.buffer->reusable = false;
+               t_buffer.buffer->name = "thread " + std::to_string(tid);
+            }
+         }
+
+         if (t_buffer.buffer == nullptr)
+         {
+            m_buffers.emplace_back(new Buffer());
+            t_buffer.buffer = m_buffers.back().get();
+            t_buffer.buffer->name = "thread " + std::to_string(m_buffers.size() - 1);
+         }
+      }
+
+      return *t_buffer.buffer;
+   }
+
+   void retire(Buffer& buffer)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      buffer.retired = true;
+   }
+
+   // Write a JSON string, escaping quotes, backslashes and control characters
+   static void writeString(std::ostream& out, const char* text)
+   {
+      out << '"';
+
+      for (const char* c = text; *c != '\0'; c++)
+      {
+         if (*c == '"' || *c == '\\')
+         {
+            out << '\\' << *c;
+         }
+         else if (static_cast<unsigned char>(*c) < 0x20)
+         {
+            const char* digits = "0123456789abcdef";
+            out << "\\u00" << digits[*c >> 4] << digits[*c & 0xF];
+         }
+         else
+         {
+            out << *c;
+         }
+      }
+
+      out << '"';
+   }
+
+   static const char* phaseCode(Phase phase)
+   {
+      switch (phase)
+      {
+      case Phase::Begin:
+         return "B";
+      case Phase::End:
+         return "E";
+      default:
+         return "i";
+      }
+   }
+
+   static void writeSeparator(std::ostream& out, bool& first)
+   {
+      if (!first)
+      {
+         out << ",\n";
+      }
+
+      first = false;
+   }
+
+   const std::chrono::steady_clock::time_point m_start;
+
+   std::mutex m_mutex;
+   std::vector<std::unique_ptr<Buffer>> m_buffers;
+};
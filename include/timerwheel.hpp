@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Hashed timer wheel: one slot per tick, each value in the slot of the tick
+// of its deadline. Values due more than a turn later stay in their slot and
+// are skipped until their turn. Adding is O(1), and expiring only visits the
+// slots of the ticks elapsed since the last expiry.
+// Not thread safe.
+template<typename T>
+class TimerWheel
+{
+public:
+   using Clock = std::chrono::steady_clock;
+
+   static constexpr size_t SLOTS = 256;
+   static constexpr Clock::duration TICK = std::chrono::milliseconds(1);
+
+   TimerWheel() : m_current(tickOf(Clock::now())), m_next(Clock::time_point::max()), m_size(0)
+   {
+   }
+
+   void add(T value, Clock::time_point deadline)
+   {
+      // Deadlines already passed go to the next slot to expire
+      int64_t tick = std::max(tickOf(deadline), m_current);
+      m_slots[tick % SLOTS].push_back({value, deadline});
+
+      m_next = std::min(m_next, deadline);
+      m_size++;
+   }
+
+   // Call due(value) for each value whose deadline is not after now, and
+   // return their number
+   template<typename F>
+   size_t expire(Clock::time_point now, F&& due)
+   {
+      if (now < m_next)
+      {
+         return 0;
+      }
+
+      // The slot of now is visited again next time, for its later deadlines
+      int64_t last = std::min(tickOf(now), m_current + static_cast<int64_t>(SLOTS) - 1);
+      size_t count = 0;
+
+      for (int64_t tick = m_current; tick <= last; tick++)
+      {
+         std::vector<Timer>& slot = m_slots[tick % SLOTS];
+
+         for (size_t i = 0; i < slot.size(); )
+         {
+            if (slot[i].deadline <= now)
+            {
+               due(slot[i].value);
+               slot[i] = slot.back();
+               slot.pop_back();
+               count++;
+            }
+            else
+            {
+               i++;
+            }
+         }
+      }
+
+      m_current = tickOf(now);
+      m_size -= count;
+      m_next = findNext();
+
+      return count;
+   }
+
+   // Earliest deadline, or Clock::time_point::max() without values
+   Clock::time_point next() const
+   {
+      return m_next;
+   }
+
+   size_t size() const
+   {
+      return m_size;
+   }
+
+private:
+   struct Timer
+   {
+      T value;
+      Clock::time_point deadline;
+   };
+
+   static int64_t tickOf(Clock::time_point time)
+   {
+      return time.time_since_epoch() / TICK;
+   }
+
+   // Walk the slots from the current tick. The values of a slot are due at
+   // its tick or a turn later, so the walk stops at the first slot starting
+   // after the earliest deadline found so far.
+   Clock::time_point findNext() const
+   {
+      Clock::time_point next = Clock::time_point::max();
+
+      if (m_size == 0)
+      {
+         return next;
+      }
+
+      for (int64_t tick = m_current; tick < m_current + static_cast<int64_t>(SLOTS); tick++)
+      {
+         if (Clock::time_point(tick * TICK) > next)
+         {
+            break;
+         }
+
+         for (const Timer& timer : m_slots[tick % SLOTS])
+         {
+            next = std::min(next, timer.deadline);
+         }
+      }
+
+      return next;
+   }
+
+   std::array<std::vector<Timer>, SLOTS> m_slots;
+
+   // First tick not fully expired
+   int64_t m_current;
+
+   Clock::time_point m_next;
+   size_t m_size;
+};
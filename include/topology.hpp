@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// The CPUs this process may run on, grouped by NUMA node
+struct CpuTopology
+{
+   // CPUs of each node, nodes without allowed CPUs are left out
+   std::vector<std::vector<int>> nodes;
+
+   size_t cpuCount() const
+   {
+      size_t count = 0;
+      for (const std::vector<int>& cpus : nodes)
+      {
+         count += cpus.size();
+      }
+
+      return count;
+   }
+};
+
+// Parse a kernel cpu list such as "0-3,8,10-11"
+inline std::vector<int> parseCpuList(const std::string& list)
+{
+   std::vector<int> cpus;
+   std::stringstream stream(list);
+   std::string range;
+
+   while (std::getline(stream, range, ','))
+   {
+      if (range.empty() || range == "\n")
+      {
+         continue;
+      }
+
+      size_t dash = range.find('-');
+      int first = std::stoi(range.substr(0, dash));
+      int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+      for (int cpu = first; cpu <= last; cpu++)
+      {
+         cpus.push_back(cpu);
+      }
+   }
+
+   return cpus;
+}
+
+// Read the topology from sysfs. Without NUMA information, all the allowed
+// CPUs are in a single node.
+inline CpuTopology readCpuTopology()
+{
+   CpuTopology topology;
+
+#ifdef __linux__
+   cpu_set_t allowed;
+   CPU_ZERO(&allowed);
+   sched_getaffinity(0, sizeof(allowed), &allowed);
+
+   for (int node = 0; ; node++)
+   {
+      std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      if (!file)
+      {
+         break;
+      }
+
+      std::string list;
+      std::getline(file, list);
+
+      std::vector<int> cpus;
+      for (int cpu : parseCpuList(list))
+      {
+         if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+         {
+            cpus.push_back(cpu);
+         }
+      }
+
+      if (!cpus.empty())
+      {
+         topology.nodes.push_back(cpus);
+      }
+   }
+
+   if (topology.nodes.empty())
+   {
+      std::vector<int> cpus;
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      {
+         if (CPU_ISSET(cpu, &allowed))
+         {
+            cpus.push_back(cpu);
+         }
+      }
+
+      topology.nodes.push_back(cpus);
+   }
+#else
+   std::vector<int> cpus;
+   for (unsigned int cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++)
+   {
+      cpus.push_back(static_cast<int>(cpu));
+   }
+
+   topology.nodes.push_back(cpus);
+#endif
+
+   return topology;
+}
+
+// Restrict the calling thread to the given CPUs. Return false if not
+// supported or refused.
+inline bool setCurrentThreadAffinity(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+   cpu_set_t set;
+   CPU_ZERO(&set);
+
+   for (int cpu : cpus)
+   {
+      CPU_SET(cpu, &set);
+   }
+
+   return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+   (void) cpus;
+   return false;
+#endif
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cassert>
+
+// Fixed capacity Chase-Lev deque, following "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli).
+// The owner thread pushes and pops at the bottom (LIFO), any other thread
+// steals from the top (FIFO). T must be lock free as an atomic.
+template<typename T>
+class WorkStealingDeque
+{
+public:
+   // capacity must be a power of two
+   explicit WorkStealingDeque(size_t capacity)
+      : m_top(0), m_bottom(0), m_buffer(new std::atomic<T>[capacity]), m_mask(capacity - 1)
+   {
+      assert(capacity > 0 && (capacity & m_mask) == 0);
+   }
+
+   // Owner thread only. Return false if the deque is full.
+   bool push(T value)
+   {
+      int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+      int64_t top = m_top.load(std::memory_order_acquire);
+
+      if (bottom - top > static_cast<int64_t>(m_mask))
+      {
+         return false;
+      }
+
+      m_buffer[bottom & m_mask].store(value, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+
+      return true;
+   }
+
+   // Owner thread only. Take the most recently pushed value.
+   bool pop(T& value)
+   {
+      int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+      m_bottom.store(bottom, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t top = m_top.load(std::memory_order_relaxed);
+
+      if (top > bottom)
+      {
+         // Empty
+         m_bottom.store(bottom + 1, std::memory_order_relaxed);
+         return false;
+      }
+
+      value = m_buffer[bottom & m_mask].load(std::memory_order_relaxed);
+
+      if (top == bottom)
+      {
+         // Last value, race against thieves for it
+         bool won = m_top.compare_exchange_strong(top, top + 1,
+               std::memory_order_seq_cst, std::memory_order_relaxed);
+         m_bottom.store(bottom + 1, std::memory_order_relaxed);
+         return won;
+      }
+
+      return true;
+   }
+
+   // Thread safe. Take the oldest value.
+   bool steal(T& value)
+   {
+      int64_t top = m_top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+      if (top >= bottom)
+      {
+         return false;
+      }
+
+      value = m_buffer[top & m_mask].load(std::memory_order_relaxed);
+
+      return m_top.compare_exchange_strong(top, top + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed);
+   }
+
+   // Thread safe, only an estimate while other threads use the deque
+   size_t size() const
+   {
+      int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+      int64_t top = m_top.load(std::memory_order_relaxed);
+
+      return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+   }
+
+   bool empty() const
+   {
+      return size() == 0;
+   }
+
+private:
+   // Top and bottom are written by different threads, keep them apart
+   alignas(64) std::atomic<int64_t> m_top;
+   alignas(64) std::atomic<int64_t> m_bottom;
+
+   std::unique_ptr<std::atomic<T>[]> m_buffer;
+   size_t m_mask;
+};
@@ -0,0 +1,460 @@
+#include "entity.hpp"
+#include "jobsystem.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Number of empty jobs run per measure
+const size_t NB_JOBS = 200000;
+
+// Jobs scheduled one by one from the main thread, through the injection queue
+double externalJobs(JobSystem &jobSystem) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (size_t i = 0; i < NB_JOBS; i++) {
+    jobSystem.schedule(jobSystem.create([] {}));
+  }
+
+  jobSystem.waitAll();
+
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+  return NB_JOBS / elapsed.count();
+}
+
+// Jobs scheduled from inside jobs, through the worker deques
+double nestedJobs(JobSystem &jobSystem) {
+  const size_t spawners = 64;
+  const size_t children = NB_JOBS / spawners;
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (size_t i = 0; i < spawners; i++) {
+    jobSystem.schedule(jobSystem.create([&jobSystem, children] {
+      for (size_t j = 0; j < children; j++) {
+        jobSystem.schedule(jobSystem.create([] {}));
+      }
+    }));
+  }
+
+  jobSystem.waitAll();
+
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+  return spawners * (children + 1) / elapsed.count();
+}
+
+struct Position {
+  int x;
+  int y;
+};
+
+struct Velocity {
+  int x;
+  int y;
+};
+
+// Number of entities of the chunk workload, as in test.cpp
+const size_t NB_ENTITIES = 100000;
+
+// Number of updates per chunk workload measure
+const size_t NB_UPDATES = 100;
+
+void updateChunk(Chunk &chunk, ChangeVersion version) {
+  chunk.each([](Position &pos, const Velocity &vel) {
+    pos.x += vel.x;
+    pos.y += vel.y;
+  }, version);
+}
+
+// One job per chunk, the way test.cpp runs its systems
+double jobPerChunk(JobSystem &jobSystem, EntityManager &em) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (size_t i = 0; i < NB_UPDATES; i++) {
+    ChangeVersion version = em.getGlobalVersion();
+
+    em.each<Position, Velocity>([&jobSystem, version](Chunk &chunk) {
+      jobSystem.schedule(jobSystem.create([&chunk, version] { updateChunk(chunk, version); }));
+    });
+
+    jobSystem.waitAll();
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+  return elapsed.count() / NB_UPDATES;
+}
+
+double parallelFor(JobSystem &jobSystem, EntityManager &em) {
+  std::vector<Chunk *> chunks;
+  em.each<Position, Velocity>([&chunks](Chunk &chunk) { chunks.push_back(&chunk); });
+
+  ChangeVersion version = em.getGlobalVersion();
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (size_t i = 0; i < NB_UPDATES; i++) {
+    jobSystem.parallel_for(0, chunks.size(), 1, [&chunks, version](size_t first, size_t last) {
+      for (size_t c = first; c < last; c++) {
+        updateChunk(*chunks[c], version);
+      }
+    });
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+  return elapsed.count() / NB_UPDATES;
+}
+
+// Ranges of chunks, each one on the worker which updated it the previous
+// time, unless stolen on imbalance
+double affinityFor(JobSystem &jobSystem, EntityManager &em) {
+  std::vector<Chunk *> chunks;
+  em.each<Position, Velocity>([&chunks](Chunk &chunk) { chunks.push_back(&chunk); });
+
+  // A few ranges per worker, to leave some to steal
+  size_t grain = std::max(chunks.size() / (4 * jobSystem.workerCount()), static_cast<size_t>(1));
+
+  ChangeVersion version = em.getGlobalVersion();
+  JobAffinity affinity;
+  auto update = [&jobSystem, &chunks, grain, &affinity, version] {
+    jobSystem.parallel_for(0, chunks.size(), grain, affinity, [&chunks, version](size_t first, size_t last) {
+      for (size_t c = first; c < last; c++) {
+        updateChunk(*chunks[c], version);
+      }
+    });
+  };
+
+  // Spread the chunks a first time
+  update();
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (size_t i = 0; i < NB_UPDATES; i++) {
+    update();
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+  return elapsed.count() / NB_UPDATES;
+}
+
+// Hardware cache counters of this process and of the threads it starts
+// afterwards, whose counts are only added once they exit. There is no
+// generic L2 event: L2 accesses are approximated by L1D read misses, and L2
+// misses by last level cache reads.
+class CacheCounters {
+public:
+  CacheCounters()
+      : m_l1Misses(open(false)), m_llAccesses(open(true)) {}
+
+  ~CacheCounters() {
+    for (int fd : {m_l1Misses, m_llAccesses}) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  bool available() const { return m_l1Misses >= 0 && m_llAccesses >= 0; }
+
+  // Fraction of the L1 misses served by the L2
+  double l2HitRate() const {
+    double l1Misses = static_cast<double>(read(m_l1Misses));
+    double llAccesses = static_cast<double>(read(m_llAccesses));
+    return l1Misses > 0 ? 1 - llAccesses / l1Misses : 0;
+  }
+
+private:
+  int m_l1Misses;
+  int m_llAccesses;
+
+  // L1D read misses, or last level cache reads
+  static int open(bool lastLevel) {
+#ifdef __linux__
+    uint64_t cache = lastLevel ? PERF_COUNT_HW_CACHE_LL : PERF_COUNT_HW_CACHE_L1D;
+    uint64_t result = lastLevel ? PERF_COUNT_HW_CACHE_RESULT_ACCESS : PERF_COUNT_HW_CACHE_RESULT_MISS;
+
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+    (void)lastLevel;
+    return -1;
+#endif
+  }
+
+  static uint64_t read(int fd) {
+    uint64_t count = 0;
+    return ::read(fd, &count, sizeof(count)) == sizeof(count) ? count : 0;
+  }
+};
+
+// L2 hit rate of the chunk updates, with or without affinity, run by a job
+// system started and stopped inside the measure. Negative without counters.
+double chunkL2HitRate(EntityManager &em, size_t workers, bool withAffinity) {
+  CacheCounters counters;
+  if (!counters.available()) {
+    return -1;
+  }
+
+  {
+    JobSystem jobSystem(workers);
+
+    if (withAffinity) {
+      affinityFor(jobSystem, em);
+    } else {
+      parallelFor(jobSystem, em);
+    }
+  }
+
+  return counters.l2HitRate();
+}
+
+// Jobs each depending on the previous one, so that every job starts when the
+// previous one completes. Return the time per job to job handoff.
+double dependencyChain(JobSystem &jobSystem) {
+  const size_t length = 10000;
+
+  JobHandle first = jobSystem.create([] {});
+  JobHandle previous = first;
+
+  for (size_t i = 1; i < length; i++) {
+    JobHandle next = jobSystem.create([] {});
+    jobSystem.schedule(next, previous);
+    previous = next;
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  jobSystem.schedule(first);
+  jobSystem.wait(previous);
+
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+  return elapsed.count() / length;
+}
+
+// Frame graph: layers of empty jobs, each one depending on two jobs of the
+// previous layer
+const size_t GRAPH_LAYERS = 10;
+const size_t GRAPH_WIDTH = 50;
+const size_t NB_FRAMES = 1000;
+
+// The graph created and scheduled again every frame
+double rebuiltGraph(JobSystem &jobSystem) {
+  std::vector<JobHandle> previous(GRAPH_WIDTH);
+  std::vector<JobHandle> layer(GRAPH_WIDTH);
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (size_t frame = 0; frame < NB_FRAMES; frame++) {
+    JobHandle root = jobSystem.create([] {});
+
+    for (size_t l = 0; l < GRAPH_LAYERS; l++) {
+      for (size_t i = 0; i < GRAPH_WIDTH; i++) {
+        layer[i] = jobSystem.create([] {}, root);
+      }
+
+      for (size_t i = 0; i < GRAPH_WIDTH; i++) {
+        if (l == 0) {
+          jobSystem.schedule(layer[i]);
+        } else {
+          jobSystem.schedule(layer[i], {previous[i], previous[(i + 1) % GRAPH_WIDTH]});
+        }
+      }
+
+      std::swap(layer, previous);
+    }
+
+    jobSystem.schedule(root);
+    jobSystem.wait(root);
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+  return elapsed.count() / NB_FRAMES;
+}
+
+// The same graph recorded once, and launched every frame
+double launchedGraph(JobSystem &jobSystem) {
+  JobGraph graph(jobSystem);
+  std::vector<JobGraph::Node> previous(GRAPH_WIDTH);
+  std::vector<JobGraph::Node> layer(GRAPH_WIDTH);
+
+  for (size_t l = 0; l < GRAPH_LAYERS; l++) {
+    for (size_t i = 0; i < GRAPH_WIDTH; i++) {
+      layer[i] = graph.add([] {});
+
+      if (l > 0) {
+        graph.addDependency(layer[i], previous[i]);
+        graph.addDependency(layer[i], previous[(i + 1) % GRAPH_WIDTH]);
+      }
+    }
+
+    std::swap(layer, previous);
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (size_t frame = 0; frame < NB_FRAMES; frame++) {
+    jobSystem.wait(graph.launch());
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+  return elapsed.count() / NB_FRAMES;
+}
+
+double threadCpuSeconds() {
+  timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+double processCpuSeconds() {
+  timespec time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Wait on a job sleeping for the given time, report the time between the end
+// of the job and the return of wait, and the CPU used by the waiting thread
+void waitLatency(JobSystem &jobSystem, std::chrono::microseconds duration) {
+  const size_t rounds = 20;
+  double latency = 0;
+  double cpu = 0;
+
+  for (size_t i = 0; i < rounds; i++) {
+    std::chrono::high_resolution_clock::time_point jobEnd;
+
+    JobHandle handle = jobSystem.create([duration, &jobEnd] {
+      std::this_thread::sleep_for(duration);
+      jobEnd = std::chrono::high_resolution_clock::now();
+    });
+
+    double cpuStart = threadCpuSeconds();
+    jobSystem.schedule(handle);
+    jobSystem.wait(handle);
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - jobEnd;
+    latency += elapsed.count();
+    cpu += threadCpuSeconds() - cpuStart;
+  }
+
+  std::cout << duration.count() << "us\t" << latency / rounds * 1e6 << "\t"
+            << cpu / rounds * 1e6 << std::endl;
+}
+
+int main(int argc, char **argv) {
+  size_t maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+
+  if (argc > 1) {
+    maxWorkers = static_cast<size_t>(std::atoi(argv[1]));
+  }
+
+  std::cout << "Empty job throughput (jobs/s), " << NB_JOBS << " jobs per run\n";
+  std::cout << "workers\texternal\tnested\n";
+
+  for (size_t workers = 1; workers <= maxWorkers; workers++) {
+    JobSystem jobSystem(workers);
+
+    // Warm up the job pool and the threads
+    externalJobs(jobSystem);
+
+    double external = externalJobs(jobSystem);
+    double nested = nestedJobs(jobSystem);
+
+    std::cout << workers << "\t" << external << "\t" << nested << std::endl;
+  }
+
+  std::cout << "\nDependency chain handoff (ns per job)\n";
+  std::cout << "workers\tchain\n";
+
+  for (size_t workers = 1; workers <= maxWorkers; workers++) {
+    JobSystem jobSystem(workers);
+
+    dependencyChain(jobSystem);
+
+    std::cout << workers << "\t" << dependencyChain(jobSystem) * 1e9 << std::endl;
+  }
+
+  {
+    JobSystem jobSystem(maxWorkers);
+
+    std::cout << "\nWait on a sleeping job\n";
+    std::cout << "job\twake latency (us)\twaiting thread CPU (us)\n";
+
+    waitLatency(jobSystem, std::chrono::microseconds(10));
+    waitLatency(jobSystem, std::chrono::microseconds(1000));
+    waitLatency(jobSystem, std::chrono::microseconds(20000));
+
+    // Let the workers park
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    double cpuStart = processCpuSeconds();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::cout << "CPU used by " << maxWorkers << " idle workers in 200ms: "
+              << (processCpuSeconds() - cpuStart) * 1e3 << "ms" << std::endl;
+  }
+
+  std::cout << "\nFrame graph of " << GRAPH_LAYERS * GRAPH_WIDTH << " jobs (us per frame)\n";
+  std::cout << "workers\trebuilt\tlaunched\n";
+
+  for (size_t workers = 1; workers <= maxWorkers; workers++) {
+    JobSystem jobSystem(workers);
+
+    double rebuilt = rebuiltGraph(jobSystem);
+    double launched = launchedGraph(jobSystem);
+
+    std::cout << workers << "\t" << rebuilt * 1e6 << "\t" << launched * 1e6 << std::endl;
+  }
+
+  EntityManager em;
+
+  for (size_t i = 0; i < NB_ENTITIES; i++) {
+    int x = static_cast<int>(i);
+    em.createEntity<Position, Velocity>(Position{x, x}, Velocity{x, x});
+  }
+
+  std::cout << "\nUpdate of " << NB_ENTITIES << " entities (s)\n";
+  std::cout << "workers\tjob per chunk\tparallel_for\taffinity\n";
+
+  for (size_t workers = 1; workers <= maxWorkers; workers++) {
+    JobSystem jobSystem(workers);
+
+    jobPerChunk(jobSystem, em);
+
+    double perChunk = jobPerChunk(jobSystem, em);
+    double split = parallelFor(jobSystem, em);
+    double affine = affinityFor(jobSystem, em);
+
+    std::cout << workers << "\t" << perChunk << "\t" << split << "\t" << affine << std::endl;
+  }
+
+  std::cout << "\nL2 hit rate of the updates\n";
+
+  if (chunkL2HitRate(em, 1, false) < 0) {
+    std::cout << "Hardware cache counters unavailable\n";
+  } else {
+    std::cout << "workers\tparallel_for\taffinity\n";
+
+    for (size_t workers = 1; workers <= maxWorkers; workers++) {
+      double split = chunkL2HitRate(em, workers, false);
+      double affine = chunkL2HitRate(em, workers, true);
+
+      std::cout << workers << "\t" << split << "\t" << affine << std::endl;
+    }
+  }
+
+  return 0;
+}
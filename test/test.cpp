@@ -35,6 +35,43 @@ struct Comflabulation {
 
 struct EnemyTag {};
 
+struct Stunned {
+  int turns;
+};
+
+template <> struct enableable_component<Stunned> : std::true_type {};
+
+struct Waypoint {
+  int x;
+  int y;
+};
+
+using Waypoints = Buffer<Waypoint, 4>;
+
+enum class Mingy : uint8_t { Off, On };
+
+template <> struct packed_component<Mingy> {
+  static constexpr size_t bits = 1;
+};
+
+enum class Lod : uint8_t { High, Medium, Low, Hidden };
+
+template <> struct packed_component<Lod> {
+  static constexpr size_t bits = 2;
+};
+
+struct GameClock {
+  float time;
+  int frame;
+};
+
+struct Bounds {
+  int minX;
+  int minY;
+  int maxX;
+  int maxY;
+};
+
 template <typename... C> ChunkLayout computeChunkLayout() {
   return computeChunkLayout(computeArchetype<C...>());
 }
@@ -183,12 +220,301 @@ int main() {
 
   assert(incr == 6);
 
+  int called = 0;
+
   incr = 1;
   em.each_entity([&incr](Position &pos) {
     assert(pos.x == incr && pos.y == incr);
     incr++;
   });
 
+  // CHUNK COMPONENTS
+  ChunkLayout boundsLayout = computeChunkLayout<Position, ChunkComponent<Bounds>>();
+  ComponentType boundsId = componentType<ChunkComponent<Bounds>>();
+
+  assert(boundsLayout.chunkDataSize == sizeof(Bounds));
+  assert(boundsLayout.componentStart[boundsId] == 0);
+  assert(boundsLayout.componentStart[positionId] == sizeof(Bounds));
+  assert(boundsLayout.capacity == (CHUNK_SIZE - sizeof(Bounds)) / sizeof(Position));
+
+  Entity b0 = em.createEntity<Position, ChunkComponent<Bounds>>();
+  Entity b1 = em.createEntity<Position, ChunkComponent<Bounds>>();
+  em.setComponent<Position>(b0, Position(-3, 4));
+  em.setComponent<Position>(b1, Position(7, -2));
+
+  // Chunk components are shared by all entities of the chunk
+  em.setChunkComponent<Bounds>(b0, Bounds{0, 0, 0, 0});
+  assert(em.getChunkComponent<Bounds>(b1).maxX == 0);
+
+  ChangeVersion lastUpdate = em.getGlobalVersion();
+  em.incrementGlobalVersion();
+
+  // Compute the bounds of each chunk
+  called = 0;
+  em.each_chunk([&called](Chunk &chunk, Bounds &bounds) {
+    bounds = Bounds{0, 0, 0, 0};
+    chunk.each([&bounds](const Position &pos) {
+      bounds.minX = std::min(bounds.minX, pos.x);
+      bounds.minY = std::min(bounds.minY, pos.y);
+      bounds.maxX = std::max(bounds.maxX, pos.x);
+      bounds.maxY = std::max(bounds.maxY, pos.y);
+    });
+    called++;
+  });
+
+  assert(called == 1);
+  Bounds bounds = em.getChunkComponent<Bounds>(b0);
+  assert(bounds.minX == -3 && bounds.minY == -2);
+  assert(bounds.maxX == 7 && bounds.maxY == 4);
+
+  // Without chunk components, all the chunks are visited
+  called = 0;
+  size_t lines = 0;
+  em.each_chunk([&called, &lines](Chunk &chunk) {
+    lines += chunk.count();
+    called++;
+  });
+
+  assert(called == 4);
+  assert(lines == 8);
+
+  // Only the written components are seen as changed
+  ChangeVersion boundsUpdate = em.getGlobalVersion();
+  em.incrementGlobalVersion();
+
+  em.each_chunk([lastUpdate, boundsUpdate](Chunk &chunk, const Bounds &) {
+    assert(chunk.didChange<ChunkComponent<Bounds>>(lastUpdate));
+    assert(!chunk.didChange<ChunkComponent<Bounds>>(boundsUpdate));
+    assert(!chunk.didChange<Position>(lastUpdate));
+  });
+
+  em.each_entity([](Position &pos) { pos.x++; });
+
+  em.each<Position, ChunkComponent<Bounds>>([boundsUpdate](Chunk &chunk) {
+    assert(chunk.didChange<Position>(boundsUpdate));
+    assert(!chunk.didChange<ChunkComponent<Bounds>>(boundsUpdate));
+  });
+
+  // Writes through Chunk::each and getComponent are seen too
+  ChangeVersion entityUpdate = em.getGlobalVersion();
+  em.incrementGlobalVersion();
+
+  em.each<Position, ChunkComponent<Bounds>>([&em](Chunk &chunk) {
+    chunk.each([](Position &pos) { pos.y++; }, em.getGlobalVersion());
+  });
+
+  em.each<Position, ChunkComponent<Bounds>>([entityUpdate](Chunk &chunk) {
+    assert(chunk.didChange<Position>(entityUpdate));
+  });
+
+  ChangeVersion chunkUpdate = em.getGlobalVersion();
+  em.incrementGlobalVersion();
+
+  em.getComponent<Position>(b1).x = 0;
+
+  em.each<Position, ChunkComponent<Bounds>>([chunkUpdate](Chunk &chunk) {
+    assert(chunk.didChange<Position>(chunkUpdate));
+    assert(!chunk.didChange<ChunkComponent<Bounds>>(chunkUpdate));
+  });
+
+  // ENABLEABLE COMPONENTS
+  ChunkLayout stunnedLayout = computeChunkLayout<Position, Stunned>();
+  ComponentType stunnedId = componentType<Stunned>();
+  size_t stunnedCapacity = stunnedLayout.capacity;
+
+  assert(stunnedLayout.enabledMaskCount == 1);
+  assert(stunnedCapacity * (sizeof(Position) + sizeof(Stunned)) +
+             maskWordCount(stunnedCapacity) * sizeof(MaskWord) <= CHUNK_SIZE);
+  assert(stunnedLayout.enabledStart[stunnedId] + maskWordCount(stunnedCapacity) * sizeof(MaskWord) <=
+         std::min(stunnedLayout.componentStart[positionId], stunnedLayout.componentStart[stunnedId]));
+
+  // Span more than one mask word
+  std::vector<Entity> stunnedEntities;
+  for (int i = 0; i < 150; i++) {
+    stunnedEntities.push_back(em.createEntity<Position, Stunned>(Position(i, i), Stunned{i}));
+  }
+
+  // Entities start enabled
+  called = 0;
+  em.each_entity([&called](const Stunned &) { called++; });
+  assert(called == 150);
+
+  for (int i = 0; i < 150; i++) {
+    if (i % 3 != 0) {
+      em.setEnabled<Stunned>(stunnedEntities[i], false);
+    }
+  }
+
+  assert(em.isEnabled<Stunned>(stunnedEntities[0]));
+  assert(!em.isEnabled<Stunned>(stunnedEntities[1]));
+
+  // Only enabled lines are visited, in order
+  int expected = 0;
+  em.each_entity([&expected](const Position &pos, Stunned &stunned) {
+    assert(stunned.turns == expected && pos.x == expected);
+    expected += 3;
+  });
+  assert(expected == 150);
+
+  // Components that are not enableable are still visited for every line
+  called = 0;
+  em.each<Stunned>([&called](Chunk &chunk) {
+    chunk.each([&called](const Position &) { called++; });
+  });
+  assert(called == 150);
+
+  // BUFFER COMPONENTS
+  Entity walker0 = em.createEntity<Position, Waypoints>();
+  Entity walker1 = em.createEntity<Position, Waypoints>();
+
+  // New buffers are empty and stored in the chunk
+  assert(em.getComponent<Waypoints>(walker0).empty());
+  assert(em.getComponent<Waypoints>(walker0).isInline());
+
+  em.each_entity([](const Position &, Waypoints &waypoints) {
+    for (int i = 0; i < 3; i++) {
+      waypoints.push_back(Waypoint{i, i});
+    }
+  });
+
+  // Small buffers never leave the chunk
+  Waypoints &inlineWaypoints = em.getComponent<Waypoints>(walker0);
+  assert(inlineWaypoints.size() == 3 && inlineWaypoints.isInline());
+  assert(reinterpret_cast<uint8_t *>(inlineWaypoints.data()) > reinterpret_cast<uint8_t *>(&inlineWaypoints));
+
+  // Bigger ones spill to the heap, keeping their content
+  Waypoints &spilledWaypoints = em.getComponent<Waypoints>(walker1);
+  for (int i = 3; i < 20; i++) {
+    spilledWaypoints.push_back(Waypoint{i, i});
+  }
+  assert(spilledWaypoints.size() == 20 && !spilledWaypoints.isInline());
+  assert(spilledWaypoints.capacity() >= 20);
+
+  int sum = 0;
+  em.each_entity([&sum](const Waypoints &waypoints) {
+    for (const Waypoint &waypoint : waypoints) {
+      sum += waypoint.x;
+    }
+  });
+  assert(sum == 0 + 1 + 2 + 19 * 20 / 2);
+
+  // Relocated chunks keep their content, and buffers their heap storage
+  em.each<Waypoints>([](Chunk &chunk) { chunk.relocate(); });
+  assert(em.getComponent<Waypoints>(walker1).size() == 20);
+  assert(em.getComponent<Waypoints>(walker1)[19].x == 19);
+  assert(em.getComponent<Waypoints>(walker0)[2].y == 2);
+
+  // Appending an element of the buffer itself, while it grows
+  {
+    Buffer<Waypoint, 1> path;
+    path.push_back(Waypoint{7, 8});
+
+    for (int i = 0; i < 200; i++) {
+      path.push_back(path[0]);
+    }
+
+    assert(path.size() == 201 && !path.isInline());
+    for (const Waypoint &waypoint : path) {
+      assert(waypoint.x == 7 && waypoint.y == 8);
+    }
+  }
+
+  // Buffers are moved into entities, handing over their heap storage
+  {
+    using Path = Buffer<Waypoint, 1>;
+    Entity mover = em.createEntity<Path>();
+    {
+      Path path;
+      for (int i = 0; i < 3; i++) {
+        path.push_back(Waypoint{i, -i});
+      }
+
+      em.setComponent(mover, std::move(path));
+      assert(path.empty() && path.isInline());
+    }
+
+    Path &moved = em.getComponent<Path>(mover);
+    moved.push_back(Waypoint{3, -3});
+    assert(moved.size() == 4 && moved[2].y == -2 && moved[3].x == 3);
+
+    Path inlined;
+    inlined.push_back(Waypoint{9, 9});
+    em.setComponent(mover, std::move(inlined));
+    assert(em.getComponent<Path>(mover).size() == 1);
+    assert(em.getComponent<Path>(mover)[0].x == 9);
+  }
+
+  // SINGLETON COMPONENTS
+  assert(!em.hasSingleton<GameClock>());
+
+  ChangeVersion beforeClock = em.getGlobalVersion();
+  em.incrementGlobalVersion();
+  em.setSingleton(GameClock{0.0f, 0});
+
+  assert(em.hasSingleton<GameClock>());
+  assert(em.didSingletonChange<GameClock>(beforeClock));
+
+  ChangeVersion afterClock = em.getGlobalVersion();
+  em.incrementGlobalVersion();
+
+  assert(em.getSingleton<GameClock>().frame == 0);
+  assert(!em.didSingletonChange<GameClock>(afterClock));
+
+  em.writeSingleton<GameClock>().frame++;
+  assert(em.getSingleton<GameClock>().frame == 1);
+  assert(em.didSingletonChange<GameClock>(afterClock));
+
+  // PACKED COMPONENTS
+  ChunkLayout packedLayout = computeChunkLayout<Position, Mingy, Lod>();
+  size_t packedCapacity = packedLayout.capacity;
+
+  // Far more lines than with one byte per flag
+  assert(packedCapacity > CHUNK_SIZE / (sizeof(Position) + 2));
+  assert(packedCapacity * sizeof(Position) + maskWordCount(packedCapacity) * sizeof(MaskWord) +
+             maskWordCount(2 * packedCapacity) * sizeof(MaskWord) <= CHUNK_SIZE);
+
+  std::vector<Entity> flagged;
+  for (int i = 0; i < 130; i++) {
+    flagged.push_back(em.createEntity<Position, Mingy, Lod>(
+        Position(i, i), i % 2 == 0 ? Mingy::On : Mingy::Off, static_cast<Lod>(i % 4)));
+  }
+
+  assert(em.getPacked<Mingy>(flagged[0]) == Mingy::On);
+  assert(em.getPacked<Mingy>(flagged[1]) == Mingy::Off);
+  assert(em.getPacked<Lod>(flagged[3]) == Lod::Hidden);
+
+  ChangeVersion beforeLod = em.getGlobalVersion();
+  em.incrementGlobalVersion();
+
+  em.getPacked<Lod>(flagged[3]) = Lod::Medium;
+  assert(em.getPacked<Lod>(flagged[3]) == Lod::Medium);
+  assert(em.getPacked<Lod>(flagged[2]) == Lod::Low);
+  assert(em.getPacked<Lod>(flagged[4]) == Lod::High);
+
+  // Flip every flag, 64 lines at a time
+  ChangeVersion beforeFlip = em.getGlobalVersion();
+  em.incrementGlobalVersion();
+
+  em.each<Mingy>([&em, beforeFlip](Chunk &chunk) {
+    assert(!chunk.didChange<Mingy>(beforeFlip));
+    chunk.eachPacked<Mingy>([](MaskWord &word) { word = ~word; }, em.getGlobalVersion());
+    assert(chunk.didChange<Mingy>(beforeFlip));
+  });
+
+  // Only the written packed components are seen as changed
+  em.each<Lod>([beforeLod, beforeFlip](Chunk &chunk) {
+    assert(chunk.didChange<Lod>(beforeLod));
+    assert(!chunk.didChange<Lod>(beforeFlip));
+  });
+
+  for (int i = 0; i < 130; i++) {
+    assert(em.getPacked<Mingy>(flagged[i]) == (i % 2 == 0 ? Mingy::Off : Mingy::On));
+  }
+
+  // Lines created afterwards are not affected by the flip
+  Entity lateFlag = em.createEntity<Position, Mingy, Lod>();
+  assert(em.getPacked<Mingy>(lateFlag) == Mingy::Off);
+
   em = EntityManager();
   JobSystem jobSystem;
 
@@ -235,21 +561,23 @@ int main() {
 
   start = std::chrono::high_resolution_clock::now();
 
-  em.each<Position, Velocity>([&jobSystem](Chunk& chunk) {
-     JobHandle handle = jobSystem.create([&chunk] {chunk.each([](Position& pos, const Velocity& vel) {
+  em.each<Position, Velocity>([&jobSystem, &em](Chunk& chunk) {
+     ChangeVersion version = em.getGlobalVersion();
+     JobHandle handle = jobSystem.create([&chunk, version] {chunk.each([](Position& pos, const Velocity& vel) {
         pos.x += vel.x;
         pos.y += vel.y;
-     });});
+     }, version);});
      jobSystem.schedule(handle);
      jobSystem.wait(handle);
   });
 
-  em.each<Comflabulation>([&jobSystem](Chunk& chunk) {
-     JobHandle handle = jobSystem.create([&chunk] {chunk.each([](Comflabulation& conf) {
+  em.each<Comflabulation>([&jobSystem, &em](Chunk& chunk) {
+     ChangeVersion version = em.getGlobalVersion();
+     JobHandle handle = jobSystem.create([&chunk, version] {chunk.each([](Comflabulation& conf) {
         conf.thingy *= 1.000001f;
         conf.mingy = !conf.mingy;
         conf.dingy++;
-     });});
+     }, version);});
      jobSystem.schedule(handle);
      jobSystem.wait(handle);
   });
@@ -261,20 +589,22 @@ int main() {
 
   start = std::chrono::high_resolution_clock::now();
 
-  em.each<Position, Velocity>([&jobSystem](Chunk& chunk) {
-     JobHandle handle = jobSystem.create([&chunk] {chunk.each([](Position& pos, const Velocity& vel) {
+  em.each<Position, Velocity>([&jobSystem, &em](Chunk& chunk) {
+     ChangeVersion version = em.getGlobalVersion();
+     JobHandle handle = jobSystem.create([&chunk, version] {chunk.each([](Position& pos, const Velocity& vel) {
         pos.x += vel.x;
         pos.y += vel.y;
-     });});
+     }, version);});
      jobSystem.schedule(handle);
   });
 
-  em.each<Comflabulation>([&jobSystem](Chunk& chunk) {
-     JobHandle handle = jobSystem.create([&chunk] {chunk.each([](Comflabulation& conf) {
+  em.each<Comflabulation>([&jobSystem, &em](Chunk& chunk) {
+     ChangeVersion version = em.getGlobalVersion();
+     JobHandle handle = jobSystem.create([&chunk, version] {chunk.each([](Comflabulation& conf) {
         conf.thingy *= 1.000001f;
         conf.mingy = !conf.mingy;
         conf.dingy++;
-     });});
+     }, version);});
      jobSystem.schedule(handle);
   });
 
@@ -289,7 +619,7 @@ int main() {
   Entity enemy = em.createEntity<Position, Velocity, EnemyTag>();
   assert(enemy == NB_ENTITIES);
 
-  int called = 0;
+  called = 0;
 
   em.each<EnemyTag>([&called](Chunk &chunk) {
     assert(chunk.count() == 1);
@@ -0,0 +1,79 @@
+#include "jobcoroutine.hpp"
+
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <cassert>
+
+JobCoroutine sumAll(JobSystem& jobSystem, std::atomic<int>& sum, int count)
+{
+   for (int i = 1; i <= count; i++)
+   {
+      JobHandle add = jobSystem.create([&sum, i] {sum += i;});
+      jobSystem.schedule(add);
+
+      // Resumes once add is finished, maybe on another worker
+      co_await add;
+      assert(sum == i * (i + 1) / 2);
+   }
+}
+
+JobCoroutine addSteps(JobSystem& jobSystem, std::atomic<int>& total, int steps)
+{
+   for (int i = 0; i < steps; i++)
+   {
+      JobHandle add = jobSystem.create([&total] {total++;});
+      jobSystem.schedule(add);
+      co_await add;
+   }
+}
+
+JobCoroutine sleepThenSum(JobSystem& jobSystem, std::atomic<int>& sum)
+{
+   JobHandle sleep = jobSystem.create([] {std::this_thread::sleep_for(std::chrono::milliseconds(10));});
+   jobSystem.schedule(sleep);
+   co_await sleep;
+
+   // Awaiting a coroutine
+   co_await sumAll(jobSystem, sum, 10).handle();
+
+   // Awaiting a finished job does not suspend
+   co_await sleep;
+   sum += 1000;
+}
+
+int main()
+{
+   JobSystem jobSystem(2);
+
+   std::atomic<int> sum(0);
+   JobHandle summed = sumAll(jobSystem, sum, 100).handle();
+   jobSystem.wait(summed);
+   assert(sum == 5050);
+
+   // A coroutine is a dependency like any other job
+   std::atomic<int> chained(0);
+   JobHandle coroutine = sleepThenSum(jobSystem, chained).handle();
+   JobHandle after = jobSystem.create([&chained] {assert(chained == 1055);});
+   jobSystem.schedule(after, coroutine);
+   jobSystem.wait(after);
+
+   // Many coroutines suspended at the same time block no worker
+   std::atomic<int> many(0);
+   for (int i = 0; i < 1000; i++)
+   {
+      addSteps(jobSystem, many, 6);
+   }
+   jobSystem.waitAll();
+   assert(many == 6000);
+
+   // Cancelled coroutines are destroyed at their next step
+   std::atomic<int> cancelled(0);
+   JobCoroutine stopped = addSteps(jobSystem, cancelled, 1000000);
+   std::this_thread::sleep_for(std::chrono::milliseconds(10));
+   jobSystem.cancel(stopped.handle());
+   jobSystem.wait(stopped.handle());
+   assert(cancelled < 1000000);
+
+   std::cout << "Coroutine jobs OK\n";
+}
@@ -0,0 +1,166 @@
+#include "entity.hpp"
+#include "jobio.hpp"
+
+#include <fcntl.h>
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <cassert>
+
+struct Position {
+  int x;
+  int y;
+};
+
+int main()
+{
+   JobSystem jobSystem;
+
+   const size_t count = 5000;
+
+   std::vector<Position> level(count);
+   for (size_t i = 0; i < count; i++)
+   {
+      level[i] = {static_cast<int>(i), -static_cast<int>(i)};
+   }
+
+   char path[] = "/tmp/test_job_io_XXXXXX";
+   int fd = mkstemp(path);
+   assert(fd >= 0);
+   unlink(path);
+
+   for (IoBackend backend : {IoBackend::Auto, IoBackend::Threads})
+   {
+      JobIOConfig config;
+      config.backend = backend;
+      JobIO io(jobSystem, config);
+
+      std::cout << (io.usesIoUring() ? "io_uring\n" : "threads\n");
+
+      IoRequest save;
+      save.fd = fd;
+      save.buffer = level.data();
+      save.size = count * sizeof(Position);
+      jobSystem.wait(io.write(save));
+      assert(save.result == static_cast<int64_t>(save.size));
+
+      // Read the positions straight into the chunks, one read per chunk, and
+      // check them in jobs scheduled after the reads
+      EntityManager em;
+      for (size_t i = 0; i < count; i++)
+      {
+         em.createEntity(Position{0, 0});
+      }
+
+      std::vector<IoRequest> loads;
+      loads.reserve(count);
+
+      std::atomic<size_t> checked(0);
+      size_t line = 0;
+
+      em.each<Position>([&](Chunk& chunk) {
+         IoRequest& load = loads.emplace_back();
+         load.fd = fd;
+         load.buffer = chunk.column<Position>();
+         load.size = chunk.count() * sizeof(Position);
+         load.offset = line * sizeof(Position);
+         line += chunk.count();
+
+         JobHandle loaded = io.read(load);
+         JobHandle check = jobSystem.create([&chunk, &load, &checked] {
+            assert(load.result == static_cast<int64_t>(load.size));
+            chunk.each([&checked](const Position& pos) {
+               assert(pos.x == -pos.y);
+               checked++;
+            });
+         });
+         jobSystem.schedule(check, loaded);
+      });
+
+      jobSystem.waitAll();
+      assert(line == count);
+      assert(checked == count);
+
+      size_t index = 0;
+      em.each_entity([&index](const Position& pos) {
+         assert(pos.x == static_cast<int>(index));
+         index++;
+      });
+
+      // Short read at the end of the file
+      std::vector<Position> tail(10);
+      IoRequest end;
+      end.fd = fd;
+      end.buffer = tail.data();
+      end.size = tail.size() * sizeof(Position);
+      end.offset = (count - 4) * sizeof(Position);
+      jobSystem.wait(io.read(end));
+      assert(end.result == static_cast<int64_t>(4 * sizeof(Position)));
+      assert(tail[3].x == static_cast<int>(count - 1));
+
+      // Errors complete the job too
+      IoRequest invalid;
+      invalid.fd = -1;
+      invalid.buffer = tail.data();
+      invalid.size = sizeof(Position);
+      jobSystem.wait(io.read(invalid));
+      assert(invalid.result == -EBADF);
+
+      // The only worker, waiting on reads inside a job, is woken by their
+      // completions well before the park timeout
+      JobSystemConfig nestedConfig;
+      nestedConfig.workerCount = 1;
+      nestedConfig.backoff.parkTimeout = std::chrono::seconds(2);
+
+      JobSystem nested(nestedConfig);
+      JobIO nestedIo(nested, config);
+
+      auto start = std::chrono::steady_clock::now();
+      JobHandle reader = nested.create([&nested, &nestedIo, &tail, fd] {
+         for (size_t i = 0; i < 20; i++)
+         {
+            IoRequest load;
+            load.fd = fd;
+            load.buffer = tail.data();
+            load.size = sizeof(Position);
+            load.offset = i * sizeof(Position);
+            nested.wait(nestedIo.read(load));
+            assert(tail[0].x == static_cast<int>(i));
+         }
+      });
+      nested.schedule(reader);
+
+      while (!nested.finished(reader))
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+
+      assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+
+      // Same once the worker sleeps, the read being submitted later
+      JobHandle gate = nested.create([] {});
+      JobHandle gated = nested.create([&nested, gate] {nested.wait(gate);});
+      nested.schedule(gated);
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+      start = std::chrono::steady_clock::now();
+      IoRequest late;
+      late.fd = fd;
+      late.buffer = tail.data();
+      late.size = sizeof(Position);
+      nested.schedule(gate, nestedIo.read(late));
+
+      while (!nested.finished(gated))
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+
+      assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+      assert(late.result == static_cast<int64_t>(sizeof(Position)));
+   }
+
+   close(fd);
+
+   std::cout << "Job I/O OK\n";
+}
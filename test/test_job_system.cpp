@@ -3,6 +3,9 @@
 #include <thread>
 #include <chrono>
 #include <iostream>
+#include <cassert>
+#include <mutex>
+#include <functional>
 
 int main()
 {
@@ -10,8 +13,8 @@ int main()
 
    JobHandle root = jobSystem.create([] {});
 
-   JobHandle handle1 = jobSystem.create([] {std::this_thread::sleep_for(std::chrono::seconds(1));});
-   jobSystem.schedule(handle1);
+   JobHandle handle1 = jobSystem.create([] {});
+   jobSystem.schedule_after(handle1, std::chrono::seconds(1));
 
    JobHandle handle2 = jobSystem.create([] {std::cout << "INSTANT HELLO\n";}, root);
    jobSystem.schedule(handle2);
@@ -31,24 +34,627 @@ int main()
    jobSystem.waitAll();
 
    // Try to depend on multiple tasks
-   root = jobSystem.create([] {});
-
    // Task D, depend on task A, B and C
-   // To do that, create root, and assign root as a parent of A, B and C
-   JobHandle taskA = jobSystem.create([] {std::cout << "TASK A!!!\n";}, root);
-   JobHandle taskB = jobSystem.create([] {std::cout << "TASK B!!!\n";}, root);
-   JobHandle taskC = jobSystem.create([] {std::cout << "TASK C!!!\n";}, root);
+   std::atomic<int> done(0);
+
+   JobHandle taskA = jobSystem.create([&done] {std::cout << "TASK A!!!\n"; done++;});
+   JobHandle taskB = jobSystem.create([&done] {std::cout << "TASK B!!!\n"; done++;});
+   JobHandle taskC = jobSystem.create([&done] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      std::cout << "TASK C!!!\n";
+      done++;
+   });
 
-   JobHandle taskD = jobSystem.create([] {
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+   JobHandle taskD = jobSystem.create([&done] {
+      assert(done == 3);
       std::cout << "TASK D!!!\n";
    });
 
-   jobSystem.schedule(taskD, root);
    jobSystem.schedule(taskA);
+   jobSystem.schedule(taskD, {taskA, taskB, taskC});
    jobSystem.schedule(taskB);
    jobSystem.schedule(taskC);
-   jobSystem.schedule(root);
 
+   jobSystem.wait(taskD);
+   jobSystem.waitAll();
+
+   // Continuations see their dependencies finished
+   for (int i = 0; i < 1000; i++)
+   {
+      JobHandle first = jobSystem.create([] {});
+      JobHandle second = jobSystem.create([&jobSystem, first] {assert(jobSystem.finished(first));});
+      jobSystem.schedule(second, first);
+      jobSystem.schedule(first);
+   }
+
+   jobSystem.waitAll();
+
+   // Fan-in of more dependencies than a job has links
+   std::atomic<int> leaves(0);
+   std::vector<JobHandle> fanIn;
+
+   for (size_t i = 0; i < 3 * JobPool::MAX_DEPENDENCIES; i++)
+   {
+      fanIn.push_back(jobSystem.create([&leaves] {leaves++;}));
+   }
+
+   JobHandle join = jobSystem.create([&leaves] {assert(leaves == 3 * JobPool::MAX_DEPENDENCIES);});
+   jobSystem.schedule(join, fanIn.data(), fanIn.size());
+
+   for (JobHandle leaf : fanIn)
+   {
+      jobSystem.schedule(leaf);
+   }
+
+   jobSystem.wait(join);
+
+   // Many continuations on the same job
+   std::atomic<int> continued(0);
+   JobHandle first = jobSystem.create([] {});
+
+   for (int i = 0; i < 100; i++)
+   {
+      jobSystem.schedule(jobSystem.create([&continued] {continued++;}), first);
+   }
+
+   jobSystem.schedule(first);
    jobSystem.waitAll();
+   assert(continued == 100);
+
+   // Parallel for covers the whole range exactly once
+   std::vector<int> visits(10000, 0);
+   jobSystem.parallel_for(0, visits.size(), 16, [&visits](size_t first, size_t last) {
+      assert(first < last && last - first <= 16);
+
+      for (size_t i = first; i < last; i++)
+      {
+         visits[i]++;
+      }
+   });
+   assert(std::count(visits.begin(), visits.end(), 1) == static_cast<long>(visits.size()));
+
+   // Resize the pool, running what was scheduled before
+   std::atomic<int> resized(0);
+   for (int i = 0; i < 100; i++)
+   {
+      jobSystem.schedule(jobSystem.create([&resized] {resized++;}));
+   }
+
+   jobSystem.resize(3);
+   assert(resized == 100);
+   assert(jobSystem.workerCount() == 3);
+
+   jobSystem.parallel_for(0, 1000, 1, [&resized](size_t first, size_t last) {resized += static_cast<int>(last - first);});
+   assert(resized == 1100);
+
+   jobSystem.resize(1);
+   assert(jobSystem.workerCount() == 1);
+
+   // Job systems join their workers when destroyed
+   for (int i = 0; i < 10; i++)
+   {
+      JobSystem local(2);
+      JobHandle handle = local.create([&resized] {resized++;});
+      local.schedule(handle);
+   }
+   assert(resized == 1110);
+
+   // Workers pinned to CPUs, grouped by NUMA node
+   {
+      JobSystemConfig config;
+      config.workerCount = 4;
+      config.affinity.pinWorkers = true;
+      config.affinity.numaAware = true;
+
+      JobSystem pinned(config);
+      assert(pinned.topology().cpuCount() > 0);
+
+      for (size_t i = 0; i < pinned.workerCount(); i++)
+      {
+         assert(pinned.workerNode(i) < pinned.topology().nodes.size());
+      }
+
+      std::atomic<size_t> pinnedSum(0);
+      pinned.parallel_for(0, 1000, 10, [&pinnedSum](size_t first, size_t last) {pinnedSum += last - first;});
+      assert(pinnedSum == 1000);
+   }
+
+   // Higher priorities run first, while the worker is busy all are queued.
+   // Only the worker runs them, waiting threads do not in SingleWorker mode.
+   {
+      JobSystemConfig config;
+      config.mode = ExecutionMode::SingleWorker;
+
+      JobSystem ordered(config);
+      std::atomic<bool> started(false);
+      std::atomic<bool> open(false);
+      std::vector<JobPriority> order;
+
+      ordered.schedule(ordered.create([&started, &open] {
+         started = true;
+         while (!open)
+         {
+            std::this_thread::yield();
+         }
+      }));
+
+      while (!started)
+      {
+         std::this_thread::yield();
+      }
+
+      for (JobPriority priority : {JobPriority::Low, JobPriority::Normal, JobPriority::High})
+      {
+         ordered.schedule(ordered.create([&order, priority] {order.push_back(priority);}, priority));
+      }
+
+      open = true;
+      ordered.waitAll();
+      assert((order == std::vector<JobPriority>{JobPriority::High, JobPriority::Normal, JobPriority::Low}));
+   }
+
+   // Long running jobs leave workers for the other jobs
+   {
+      JobSystemConfig config;
+      config.workerCount = 2;
+      config.longRunningWorkers = 1;
+
+      JobSystem lanes(config);
+      std::atomic<bool> normalDone(false);
+      std::atomic<int> longRunning(0);
+      std::atomic<int> maxLongRunning(0);
+
+      for (int i = 0; i < 2; i++)
+      {
+         lanes.schedule(lanes.create([&] {
+            maxLongRunning = std::max(maxLongRunning.load(), ++longRunning);
+            while (!normalDone)
+            {
+               std::this_thread::yield();
+            }
+            longRunning--;
+         }, JobPriority::LongRunning));
+      }
+
+      lanes.schedule(lanes.create([&normalDone] {normalDone = true;}));
+
+      lanes.waitAll();
+      assert(maxLongRunning == 1);
+   }
+
+   // The job pool grows with the number of jobs alive at the same time
+   {
+      JobSystem growing(2);
+      assert(growing.jobCapacity() == JobPool::SEGMENT_SIZE);
+
+      std::atomic<size_t> alive(0);
+      std::vector<JobHandle> burst;
+
+      for (size_t i = 0; i < 3 * JobPool::SEGMENT_SIZE; i++)
+      {
+         burst.push_back(growing.create([&alive] {alive++;}));
+      }
+
+      assert(growing.jobCapacity() >= 3 * JobPool::SEGMENT_SIZE);
+
+      for (JobHandle job : burst)
+      {
+         growing.schedule(job);
+      }
+
+      growing.waitAll();
+      assert(alive == 3 * JobPool::SEGMENT_SIZE);
+   }
+
+   // Statistics of the workers, and of the threads waiting on jobs
+   {
+      JobSystem counted(2);
+
+      for (int i = 0; i < 1000; i++)
+      {
+         counted.schedule(counted.create([] {}));
+      }
+
+      counted.waitAll();
+
+      JobSystemStats stats = counted.stats();
+      assert(stats.workers.size() == 2);
+
+      uint64_t executed = stats.external.executed;
+      uint64_t time = stats.external.busyTime + stats.external.spinTime + stats.external.idleTime;
+      for (const WorkerStats& worker : stats.workers)
+      {
+         executed += worker.executed;
+         time += worker.busyTime + worker.spinTime + worker.idleTime;
+      }
+
+      assert(executed == 1000);
+      assert(time > 0);
+      assert(stats.poolExhausted == 0);
+   }
+
+   // Inline mode runs the jobs on the waiting thread, in the ready order
+   {
+      JobSystemConfig config;
+      config.mode = ExecutionMode::Inline;
+
+      JobSystem inlined(config);
+      assert(inlined.workerCount() == 0);
+
+      std::vector<int> order;
+      std::thread::id main = std::this_thread::get_id();
+
+      for (int i = 0; i < 20; i++)
+      {
+         inlined.schedule(inlined.create([&order, main, i] {
+            assert(std::this_thread::get_id() == main);
+            order.push_back(i);
+         }));
+      }
+
+      inlined.waitAll();
+
+      for (int i = 0; i < 20; i++)
+      {
+         assert(order[i] == i);
+      }
+   }
+
+   // In Inline mode, jobs scheduled from another thread wake the waiting
+   // thread well before the park timeout
+   {
+      JobSystemConfig config;
+      config.mode = ExecutionMode::Inline;
+      config.backoff.parkTimeout = std::chrono::seconds(2);
+
+      JobSystem inlined(config);
+      std::atomic<int> ran(0);
+
+      JobHandle first = inlined.create([&ran] {ran++;});
+      JobHandle second = inlined.create([&ran] {ran++;});
+      JobHandle third = inlined.create([&ran] {ran++;});
+      inlined.schedule(third, second);
+
+      auto start = std::chrono::steady_clock::now();
+      std::thread foreign([&inlined, first, second] {
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         inlined.schedule(first);
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         inlined.schedule(second);
+      });
+
+      inlined.wait(first);
+      inlined.waitAll();
+      foreign.join();
+
+      assert(ran == 3);
+      assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+   }
+
+   // A worker waiting inside a job is woken by the job it waits on being
+   // scheduled from another thread, well before the park timeout
+   {
+      JobSystemConfig config;
+      config.workerCount = 1;
+      config.backoff.parkTimeout = std::chrono::seconds(2);
+
+      JobSystem nested(config);
+      JobHandle inner = nested.create([] {});
+      JobHandle outer = nested.create([&nested, inner] {nested.wait(inner);});
+      nested.schedule(outer);
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      auto start = std::chrono::steady_clock::now();
+      nested.schedule(inner);
+
+      while (!nested.finished(outer))
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+
+      assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+   }
+
+   // A seed gives a reproducible order in Inline mode
+   {
+      auto seededOrder = [](uint64_t seed) {
+         JobSystemConfig config;
+         config.mode = ExecutionMode::Inline;
+         config.seed = seed;
+
+         JobSystem seeded(config);
+         std::vector<int> order;
+
+         for (int i = 0; i < 20; i++)
+         {
+            JobHandle job = seeded.create([&order, i] {order.push_back(i);});
+            JobHandle next = seeded.create([&order, i] {order.push_back(100 + i);});
+            seeded.schedule(next, job);
+            seeded.schedule(job);
+         }
+
+         seeded.waitAll();
+         return order;
+      };
+
+      std::vector<int> first = seededOrder(42);
+      assert(first.size() == 40);
+      assert(first == seededOrder(42));
+      assert(first != seededOrder(43));
+
+      // Dependencies still hold
+      for (int i = 0; i < 20; i++)
+      {
+         assert(std::find(first.begin(), first.end(), i) < std::find(first.begin(), first.end(), 100 + i));
+      }
+   }
+
+   // A single worker runs all the jobs
+   {
+      JobSystemConfig config;
+      config.mode = ExecutionMode::SingleWorker;
+
+      JobSystem single(config);
+      assert(single.workerCount() == 1);
+
+      std::mutex mutex;
+      std::vector<std::thread::id> threads;
+
+      for (int i = 0; i < 100; i++)
+      {
+         single.schedule(single.create([&mutex, &threads] {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.push_back(std::this_thread::get_id());
+         }));
+      }
+
+      single.waitAll();
+
+      assert(threads.size() == 100);
+      assert(std::count(threads.begin(), threads.end(), threads[0]) == 100);
+      assert(threads[0] != std::this_thread::get_id());
+   }
+
+   // MainThread jobs run on the thread which created the job system
+   {
+      JobSystemConfig config;
+      config.workerCount = 2;
+      config.backoff.parkTimeout = std::chrono::seconds(10);
+
+      JobSystem affine(config);
+      std::thread::id main = std::this_thread::get_id();
+      std::atomic<int> steps(0);
+
+      JobHandle load = affine.create([&steps] {
+         std::this_thread::sleep_for(std::chrono::milliseconds(20));
+         steps++;
+      });
+      JobHandle submit = affine.create([&steps, main] {
+         assert(std::this_thread::get_id() == main);
+         assert(steps == 1);
+         steps++;
+      }, JobPriority::MainThread);
+      JobHandle present = affine.create([&steps] {
+         assert(steps == 2);
+         steps++;
+      });
+
+      affine.schedule(present, submit);
+      affine.schedule(submit, load);
+
+      // The main thread sleeps in wait, and is woken up to run submit well
+      // before the park timeout
+      auto start = std::chrono::steady_clock::now();
+      affine.schedule(load);
+      affine.wait(present);
+      assert(steps == 3);
+      assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+      // Without waiting, pump runs them
+      std::atomic<bool> pumped(false);
+      affine.schedule(affine.create([&pumped] {pumped = true;}, JobPriority::MainThread));
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      assert(!pumped);
+      assert(affine.pump() == 1);
+      assert(pumped);
+   }
+
+   // Delayed jobs run in deadline order, without holding the worker meanwhile
+   for (ExecutionMode mode : {ExecutionMode::Inline, ExecutionMode::SingleWorker})
+   {
+      JobSystemConfig config;
+      config.mode = mode;
+      JobSystem delayed(config);
+
+      std::mutex mutex;
+      std::vector<int> order;
+      auto start = std::chrono::steady_clock::now();
+
+      for (int delay : {300, 100, 200})
+      {
+         JobHandle timer = delayed.create([&mutex, &order, delay] {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(delay);
+         });
+         delayed.schedule_after(timer, std::chrono::milliseconds(delay));
+      }
+
+      JobHandle now = delayed.create([] {});
+      delayed.schedule(now);
+      delayed.wait(now);
+      assert(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+
+      delayed.waitAll();
+      assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(300));
+      assert((order == std::vector<int>{100, 200, 300}));
+   }
+
+   // Delayed jobs run on time while the workers never run out of jobs
+   {
+      JobSystem busy(2);
+
+      std::atomic<bool> stop(false);
+      std::function<void()> spin = [&busy, &stop, &spin] {
+         std::this_thread::sleep_for(std::chrono::microseconds(200));
+         if (!stop)
+         {
+            busy.schedule(busy.create(spin));
+         }
+      };
+
+      for (int i = 0; i < 4; i++)
+      {
+         busy.schedule(busy.create(spin));
+      }
+
+      std::atomic<bool> fired(false);
+      auto start = std::chrono::steady_clock::now();
+      busy.schedule_after(busy.create([&fired] {fired = true;}), std::chrono::milliseconds(20));
+
+      while (!fired && std::chrono::steady_clock::now() - start < std::chrono::seconds(2))
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+
+      std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+      stop = true;
+      busy.waitAll();
+
+      assert(fired);
+      assert(elapsed < std::chrono::seconds(1));
+   }
+
+   // Jobs mailed to a worker run there, and ranges keep their worker
+   {
+      JobSystem mailing(3);
+
+      auto runOn = [&mailing](size_t worker) {
+         std::thread::id id;
+         JobHandle job = mailing.create([&id] {id = std::this_thread::get_id();});
+         mailing.schedule_on(job, worker);
+         mailing.wait(job);
+         return id;
+      };
+
+      std::thread::id first = runOn(1);
+      assert(runOn(1) == first);
+      assert(runOn(4) == first);
+      assert(runOn(2) != first);
+      assert(runOn(1) != std::this_thread::get_id());
+
+      JobAffinity affinity;
+      std::vector<std::atomic<int>> visits(1000);
+
+      for (int frame = 0; frame < 10; frame++)
+      {
+         mailing.parallel_for(0, visits.size(), 16, affinity, [&visits](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+               visits[i]++;
+            }
+         });
+      }
+
+      for (std::atomic<int>& count : visits)
+      {
+         assert(count == 10);
+      }
+   }
+
+   // Cancelled jobs and their descendants are skipped, continuations run
+   {
+      std::atomic<int> ran(0);
+      JobHandle streaming = jobSystem.create([&ran] {ran++;});
+      jobSystem.cancel(streaming);
+
+      for (int i = 0; i < 10; i++)
+      {
+         jobSystem.schedule(jobSystem.create([&ran] {ran++;}, streaming));
+      }
+
+      JobHandle unload = jobSystem.create([&ran] {ran += 100;});
+      jobSystem.schedule(unload, streaming);
+
+      jobSystem.schedule(streaming);
+      jobSystem.wait(unload);
+
+      assert(jobSystem.finished(streaming));
+      assert(ran == 100);
+
+      // Running jobs stop when they see it
+      std::atomic<bool> started(false);
+      JobHandle loop = jobSystem.create([&jobSystem, &started] {
+         started = true;
+         while (!jobSystem.is_cancelled())
+         {
+            std::this_thread::yield();
+         }
+      });
+
+      jobSystem.schedule(loop);
+      while (!started)
+      {
+         std::this_thread::yield();
+      }
+
+      assert(!jobSystem.is_cancelled());
+      jobSystem.cancel(loop);
+      jobSystem.wait(loop);
+
+      // Cancelling a finished job has no effect on the next use of its slot
+      jobSystem.cancel(loop);
+      std::atomic<bool> reused(false);
+      JobHandle next = jobSystem.create([&reused] {reused = true;});
+      jobSystem.schedule(next);
+      jobSystem.wait(next);
+      assert(reused);
+   }
+
+   // A graph built once and launched every frame
+   {
+      JobGraph graph(jobSystem);
+      std::atomic<int> counter(0);
+      int frame = 0;
+
+      JobGraph::Node update = graph.add([&counter] {counter++;});
+      JobGraph::Node render = graph.add([&counter, &frame] {assert(counter > frame * 102);});
+      graph.addDependency(render, update);
+
+      // Children and a fan-in of more dependencies than a job has links
+      JobGraph::Node physics = graph.add([] {});
+      JobGraph::Node sync = graph.add([&counter, &frame] {assert(counter >= frame * 102 + 101);});
+
+      for (int i = 0; i < 100; i++)
+      {
+         JobGraph::Node body = graph.add([&counter] {counter++;}, physics);
+         graph.addDependency(body, update);
+         graph.addDependency(sync, body);
+      }
+
+      JobGraph::Node end = graph.add([&counter] {counter++;});
+      graph.addDependency(end, physics);
+
+      for (frame = 0; frame < 10; frame++)
+      {
+         JobHandle launched = graph.launch();
+         jobSystem.wait(launched);
+
+         assert(counter == (frame + 1) * 102);
+         assert(jobSystem.finished(graph.handle(end)));
+      }
+   }
+
+   // Tasks up to JobTask::CAPACITY bytes are stored inline in the job
+   size_t a = 1, b = 2, c = 3, d = 4, e = 5;
+   size_t sum = 0;
+   auto add = [&sum](size_t value) {sum += value;};
+
+   auto sumTask = [a, b, c, d, e, add] {add(a + b + c + d + e);};
+   static_assert(sizeof(sumTask) > 2 * sizeof(void*), "Bigger than std::function small buffer");
+
+   JobHandle sumJob = jobSystem.create(std::move(sumTask));
+
+   jobSystem.schedule(sumJob);
+   jobSystem.wait(sumJob);
+   assert(sum == 15);
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "jobsystem.hpp"
+
+#include <sstream>
+#include <thread>
+#include <iostream>
+#include <cassert>
+
+int main()
+{
+   JobSystem jobSystem(2);
+
+   JobHandle root = jobSystem.create([] {});
+   jobSystem.setName(root, "frame");
+
+   for (int i = 0; i < 100; i++)
+   {
+      JobHandle update = jobSystem.create([] {}, root);
+      jobSystem.setName(update, "update");
+      jobSystem.schedule(update);
+   }
+
+   jobSystem.schedule(root);
+   jobSystem.wait(root);
+   jobSystem.waitAll();
+
+   std::stringstream trace;
+   JobTrace::instance().writeChromeTrace(trace);
+   std::string json = trace.str();
+
+   assert(json.find("{\"traceEvents\":[") == 0);
+   assert(json.find("\"name\":\"frame\",\"ph\":\"B\"") != std::string::npos);
+   assert(json.find("\"name\":\"frame\",\"ph\":\"E\"") != std::string::npos);
+   assert(json.find("\"name\":\"update\",\"ph\":\"B\"") != std::string::npos);
+   assert(json.find("\"name\":\"wait\",\"ph\":\"B\"") != std::string::npos);
+
+   // Each job has its begin and end, the ring buffers did not wrap
+   auto count = [&json](const std::string& pattern) {
+      size_t found = 0;
+      for (size_t at = json.find(pattern); at != std::string::npos; at = json.find(pattern, at + 1))
+      {
+         found++;
+      }
+      return found;
+   };
+   assert(count("\"name\":\"update\",\"ph\":\"B\"") == 100);
+   assert(count("\"name\":\"update\",\"ph\":\"E\"") == 100);
+
+   JobTrace::instance().clear();
+
+   std::stringstream cleared;
+   JobTrace::instance().writeChromeTrace(cleared);
+   assert(cleared.str().find("\"name\":\"update\"") == std::string::npos);
+
+   // Names are escaped in the JSON
+   JobHandle quoted = jobSystem.create([] {});
+   jobSystem.setName(quoted, "load \"level\" C:\\data");
+   jobSystem.schedule(quoted);
+   jobSystem.wait(quoted);
+
+   std::stringstream escaped;
+   JobTrace::instance().writeChromeTrace(escaped);
+   assert(escaped.str().find("\"name\":\"load \\\"level\\\" C:\\\\data\"") != std::string::npos);
+
+   // Restarted workers reuse the buffers of the stopped ones once dumped:
+   // the main thread and two generations of two workers at most
+   for (int i = 0; i < 5; i++)
+   {
+      jobSystem.resize(2);
+
+      for (int j = 0; j < 100; j++)
+      {
+         jobSystem.schedule(jobSystem.create([] {}));
+      }
+      jobSystem.waitAll();
+
+      std::stringstream dump;
+      JobTrace::instance().writeChromeTrace(dump);
+   }
+
+   std::stringstream restarted;
+   JobTrace::instance().writeChromeTrace(restarted);
+   json = restarted.str();
+   assert(count("\"thread_name\"") <= 5);
+
+   // Reused buffers start empty, the events of an exited thread only show
+   // under its own name
+   std::thread([] {
+      ECS_TRACE_THREAD_NAME("loader");
+      ECS_TRACE_INSTANT("loaded");
+   }).join();
+
+   std::stringstream exited;
+   JobTrace::instance().writeChromeTrace(exited);
+
+   std::thread([] {
+      ECS_TRACE_THREAD_NAME("streamer");
+      ECS_TRACE_INSTANT("streamed");
+   }).join();
+
+   std::stringstream reused;
+   JobTrace::instance().writeChromeTrace(reused);
+   json = reused.str();
+   assert(count("\"name\":\"streamed\"") == 1);
+   assert(count("\"name\":\"loaded\"") == count("\"name\":\"loader\""));
+   assert(count("\"thread_name\"") <= 5);
+
+   std::cout << "Job trace OK\n";
+}